@@ -0,0 +1,113 @@
+#include "arena.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+namespace CGCore
+{
+
+static const size_t kFirstBlock = 64 << 10;
+static const size_t kMaxBlock = 4 << 20;
+
+Arena::Arena() : m_blocks(NULL), m_pos(NULL), m_end(NULL), m_nextSize(kFirstBlock), m_bytes(0), m_destructors(NULL)
+{
+}
+
+Arena::~Arena()
+{
+	clear();
+}
+
+static inline char* alignUp(char* p, size_t align)
+{
+	return (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+	char* p = alignUp(m_pos, align);
+	if (m_pos && p <= m_end && size <= (size_t)(m_end - p))
+	{
+		m_pos = p + size;
+		return p;
+	}
+
+	//Large allocations get a block of their own so that the current block keeps its free space
+	if (size + align > m_nextSize / 4) return alignUp((char*)allocateBlock(size + align - 1, false), align);
+
+	p = alignUp((char*)allocateBlock(m_nextSize, true), align);
+	m_nextSize = min(2 * m_nextSize, kMaxBlock);
+	m_pos = p + size;
+	return p;
+}
+
+void* Arena::allocateBlock(size_t size, bool current)
+{
+	Block* block = (Block*)malloc(sizeof(Block) + size);
+	if (!block) throw bad_alloc();
+	block->next = m_blocks;
+	block->size = size;
+	m_blocks = block;
+	m_bytes += size;
+
+	char* data = (char*)(block + 1);
+	if (current) m_end = data + size;
+	return data;
+}
+
+void Arena::addDestructor(void* object, void (*destroy)(void*))
+{
+	Destructor* destructor = (Destructor*)allocate(sizeof(Destructor), alignment_of<Destructor>::value);
+	destructor->object = object;
+	destructor->destroy = destroy;
+	destructor->next = m_destructors;
+	m_destructors = destructor;
+}
+
+void Arena::clear()
+{
+	//Objects are destroyed in reverse order of creation
+	for (Destructor* d = m_destructors; d; d = d->next) d->destroy(d->object);
+	m_destructors = NULL;
+
+	while (m_blocks)
+	{
+		Block* next = m_blocks->next;
+		free(m_blocks);
+		m_blocks = next;
+	}
+	m_pos = m_end = NULL;
+	m_nextSize = kFirstBlock;
+	m_bytes = 0;
+}
+
+void Arena::merge(Arena& other)
+{
+	//The blocks of other are only freed with ours, the current block and its free space stay ours
+	if (other.m_blocks)
+	{
+		Block* last = other.m_blocks;
+		while (last->next) last = last->next;
+		last->next = m_blocks;
+		m_blocks = other.m_blocks;
+		m_bytes += other.m_bytes;
+	}
+	if (other.m_destructors)
+	{
+		Destructor* last = other.m_destructors;
+		while (last->next) last = last->next;
+		last->next = m_destructors;
+		m_destructors = other.m_destructors;
+	}
+
+	other.m_blocks = NULL;
+	other.m_destructors = NULL;
+	other.m_pos = other.m_end = NULL;
+	other.m_nextSize = kFirstBlock;
+	other.m_bytes = 0;
+}
+
+}
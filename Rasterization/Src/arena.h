@@ -0,0 +1,109 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <new>
+#include <cstddef>
+#include <type_traits>
+
+namespace CGCore
+{
+
+/*
+* Bump allocator for data that lives and dies together, such as the scene of a document. Objects are carved
+* out of large blocks in the order they are created and released all at once with the arena. The destructors
+* of the objects that need one are run then, the other objects are simply dropped.
+*/
+class Arena
+{
+public:
+	Arena();
+	~Arena();
+
+	/* size bytes aligned on align, a power of two*/
+	void* allocate(size_t size, size_t align);
+
+	template <class T>
+	T* create()
+	{
+		T* object = new (allocate(sizeof(T), std::alignment_of<T>::value)) T();
+		if (!std::is_trivially_destructible<T>::value) addDestructor(object, &destroy<T>);
+		return object;
+	}
+
+	/* Uninitialized storage for count items, for types without constructor nor destructor to run*/
+	template <class T>
+	T* allocateArray(size_t count)
+	{
+		return count ? (T*)allocate(count * sizeof(T), std::alignment_of<T>::value) : NULL;
+	}
+
+	/* Run the destructors and release the blocks*/
+	void clear();
+
+	/* Take over the blocks and objects of other, built on another thread for instance. other is left empty.*/
+	void merge(Arena& other);
+
+	/* Bytes of the blocks held*/
+	size_t bytes() const { return m_bytes; }
+
+private:
+	Arena(const Arena&);		   //not copyable
+	void operator=(const Arena&);
+
+	struct Block
+	{
+		Block* next;
+		size_t size;
+	};
+
+	struct Destructor
+	{
+		void*		object;
+		void		(*destroy)(void*);
+		Destructor* next;
+	};
+
+	template <class T>
+	static void destroy(void* object) { static_cast<T*>(object)->~T(); }
+
+	void addDestructor(void* object, void (*destroy)(void*));
+	void* allocateBlock(size_t size, bool current);
+
+	Block*		m_blocks;
+	char*		m_pos;		 //free space of the current block
+	char*		m_end;
+	size_t		m_nextSize;	 //size of the next block
+	size_t		m_bytes;
+	Destructor* m_destructors; //most recent first
+}; // class Arena
+
+/* Fixed size array allocated from an Arena, which owns its items*/
+template <class T>
+struct ArenaArray
+{
+	ArenaArray() : data(NULL), count(0) {}
+
+	size_t	 size() const { return count; }
+	bool	 empty() const { return count == 0; }
+	T&		 operator[](size_t i) { return data[i]; }
+	const T& operator[](size_t i) const { return data[i]; }
+	T*		 begin() { return data; }
+	T*		 end() { return data + count; }
+	const T* begin() const { return data; }
+	const T* end() const { return data + count; }
+
+	/* Copy items[0, n) to the arena*/
+	void assign(Arena& arena, const T* items, size_t n)
+	{
+		data = arena.allocateArray<T>(n);
+		count = n;
+		for (size_t i = 0; i < n; ++i) data[i] = items[i];
+	}
+
+	T*	   data;
+	size_t count;
+};
+
+}
+
+#endif
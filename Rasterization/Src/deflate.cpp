@@ -0,0 +1,473 @@
+#include "deflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace CGCore
+{
+
+static const int	kMinMatch	 = 4;		//matches are found through a hash of 4 bytes
+static const int	kMaxMatch	 = 258;
+static const int	kWindow		 = 32768;
+static const int	kHashBits	 = 15;
+static const size_t kBlockTokens = 1 << 15; //tokens of a dynamic block
+static const size_t kStoredMax	 = 65535;
+
+static const int kLengthBase[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const int kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int kDistBase[30]	  = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const int kDistExtra[30]	  = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const int kCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+/* Lookup tables, filled before main so that the encoders running on the pool only read them*/
+struct DeflateTables
+{
+	unsigned char lengthCode[kMaxMatch + 1]; //index in kLengthBase of a match length
+	unsigned char distCode[512];			 //index in kDistBase of distance - 1, below 256 directly, then by 128
+	uint32_t	  crc[8][256];				 //slicing by 8
+
+	DeflateTables()
+	{
+		for (int code = 0; code < 29; ++code)
+			for (int len = kLengthBase[code]; len < kLengthBase[code] + (1 << kLengthExtra[code]) && len <= kMaxMatch; ++len)
+				lengthCode[len] = (unsigned char)code;
+		lengthCode[kMaxMatch] = 28;
+
+		for (int code = 0; code < 30; ++code)
+			for (int d = kDistBase[code] - 1; d < kDistBase[code] - 1 + (1 << kDistExtra[code]); ++d)
+			{
+				if (d < 256) distCode[d] = (unsigned char)code;
+				else		 distCode[256 + (d >> 7)] = (unsigned char)code;
+			}
+
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			crc[0][i] = c;
+		}
+		for (int t = 1; t < 8; ++t)
+			for (int i = 0; i < 256; ++i)
+				crc[t][i] = (crc[t - 1][i] >> 8) ^ crc[0][crc[t - 1][i] & 0xFF];
+	}
+};
+
+static const DeflateTables kTables;
+
+static inline int distCode(int dist)
+{
+	return dist <= 256 ? kTables.distCode[dist - 1] : kTables.distCode[256 + ((dist - 1) >> 7)];
+}
+
+/* Bits written least significant first*/
+struct BitWriter
+{
+	explicit BitWriter(vector<unsigned char>& out) : out(out), bits(0), count(0) {}
+
+	void put(uint32_t value, int n) //n <= 16
+	{
+		bits |= (uint64_t)value << count;
+		count += n;
+		if (count >= 32)
+		{
+			unsigned char bytes[4] = { (unsigned char)bits, (unsigned char)(bits >> 8), (unsigned char)(bits >> 16), (unsigned char)(bits >> 24) };
+			out.insert(out.end(), bytes, bytes + 4);
+			bits >>= 32;
+			count -= 32;
+		}
+	}
+
+	void alignByte()
+	{
+		for (; count > 0; count -= min(count, 8), bits >>= 8) out.push_back((unsigned char)bits);
+		count = 0;
+		bits = 0;
+	}
+
+	vector<unsigned char>& out;
+	uint64_t			   bits;
+	int					   count;
+};
+
+/* A literal (dist 0) or a match*/
+struct Token
+{
+	unsigned short litLen;
+	unsigned short dist;
+};
+
+/*
+* Code lengths of at most maxLength bits for the symbols of freq, 0 for the unused ones. At least 2 symbols must be used.
+* The Huffman lengths are computed with the two queues method over the symbols sorted by frequency, then the
+* longest codes are shortened to maxLength, lengthening shorter ones until the code is complete again.
+*/
+static void buildLengths(const uint32_t* freq, int n, int maxLength, unsigned char* lengths)
+{
+	vector<pair<uint32_t, int> > leaves;
+	for (int i = 0; i < n; ++i)
+	{
+		lengths[i] = 0;
+		if (freq[i]) leaves.push_back(make_pair(freq[i], i));
+	}
+	sort(leaves.begin(), leaves.end());
+	int used = (int)leaves.size();
+
+	//nodes [0, used) are the leaves, then the internal nodes in creation order
+	vector<uint32_t> weight(2 * used);
+	vector<int> parent(2 * used, -1);
+	for (int i = 0; i < used; ++i) weight[i] = leaves[i].first;
+	int nextLeaf = 0, nextNode = used, nodes = used;
+	for (int k = 0; k < used - 1; ++k)
+	{
+		int pick[2];
+		for (int j = 0; j < 2; ++j)
+		{
+			if (nextLeaf < used && (nextNode >= nodes || weight[nextLeaf] <= weight[nextNode])) pick[j] = nextLeaf++;
+			else pick[j] = nextNode++;
+		}
+		weight[nodes] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = nodes++;
+	}
+
+	//depths from the root down, a parent is created after its children
+	vector<int> depth(nodes, 0);
+	vector<int> lengthCount(max(used, maxLength) + 1, 0);
+	for (int i = nodes - 2; i >= 0; --i)
+	{
+		depth[i] = depth[parent[i]] + 1;
+		if (i < used) lengthCount[depth[i]]++;
+	}
+
+	//limit the lengths, then restore the Kraft sum to exactly 1
+	for (int len = maxLength + 1; len < (int)lengthCount.size(); ++len)
+	{
+		lengthCount[maxLength] += lengthCount[len];
+		lengthCount[len] = 0;
+	}
+	uint32_t kraft = 0;
+	for (int len = maxLength; len > 0; --len) kraft += (uint32_t)lengthCount[len] << (maxLength - len);
+	while (kraft > (1u << maxLength))
+	{
+		lengthCount[maxLength]--;
+		for (int len = maxLength - 1; len > 0; --len)
+		{
+			if (lengthCount[len])
+			{
+				lengthCount[len]--;
+				lengthCount[len + 1] += 2;
+				break;
+			}
+		}
+		kraft--;
+	}
+
+	//the least frequent symbols get the longest codes
+	int leaf = 0;
+	for (int len = maxLength; len > 0; --len)
+		for (int k = 0; k < lengthCount[len]; ++k)
+			lengths[leaves[leaf++].second] = (unsigned char)len;
+}
+
+/* Canonical codes of the lengths, bit reversed to be written least significant bit first*/
+static void buildCodes(const unsigned char* lengths, int n, unsigned short* codes)
+{
+	int lengthCount[16] = { 0 }, nextCode[16] = { 0 };
+	for (int i = 0; i < n; ++i) lengthCount[lengths[i]]++;
+	lengthCount[0] = 0;
+	for (int len = 1; len < 16; ++len) nextCode[len] = (nextCode[len - 1] + lengthCount[len - 1]) << 1;
+	for (int i = 0; i < n; ++i)
+	{
+		int len = lengths[i];
+		if (!len) continue;
+		int code = nextCode[len]++, reversed = 0;
+		for (int b = 0; b < len; ++b) reversed |= ((code >> b) & 1) << (len - 1 - b);
+		codes[i] = (unsigned short)reversed;
+	}
+}
+
+/* At least two used symbols, so that every code is complete*/
+static void ensureTwoSymbols(uint32_t* freq, int n)
+{
+	int used = 0;
+	for (int i = 0; i < n && used < 2; ++i) used += freq[i] != 0;
+	for (int i = 0; i < n && used < 2; ++i) if (!freq[i]) { freq[i] = 1; used++; }
+}
+
+static void writeStored(BitWriter& writer, const unsigned char* data, size_t size)
+{
+	do
+	{
+		size_t len = min(size, kStoredMax);
+		writer.put(0, 3); //not final, stored
+		writer.alignByte();
+		unsigned char header[4] = { (unsigned char)len, (unsigned char)(len >> 8), (unsigned char)~len, (unsigned char)(~len >> 8) };
+		writer.out.insert(writer.out.end(), header, header + 4);
+		writer.out.insert(writer.out.end(), data, data + len);
+		data += len;
+		size -= len;
+	} while (size);
+}
+
+/*
+* One block of the tokens, which encode data[0, size). Dynamic Huffman codes, or stored if that is smaller.
+*/
+static void writeBlock(BitWriter& writer, const vector<Token>& tokens, const unsigned char* data, size_t size)
+{
+	uint32_t litFreq[286] = { 0 }, distFreq[30] = { 0 };
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		const Token& t = tokens[i];
+		if (!t.dist) litFreq[t.litLen]++;
+		else
+		{
+			litFreq[257 + kTables.lengthCode[t.litLen]]++;
+			distFreq[distCode(t.dist)]++;
+		}
+	}
+	litFreq[256] = 1;
+	ensureTwoSymbols(litFreq, 286);
+	ensureTwoSymbols(distFreq, 30);
+
+	unsigned char litLengths[286], distLengths[30];
+	buildLengths(litFreq, 286, 15, litLengths);
+	buildLengths(distFreq, 30, 15, distLengths);
+	int hlit = 286, hdist = 30;
+	while (hlit > 257 && !litLengths[hlit - 1]) hlit--;
+	while (hdist > 1 && !distLengths[hdist - 1]) hdist--;
+
+	//run length encoding of the code lengths: (symbol, extra bits value)
+	unsigned char all[286 + 30];
+	memcpy(all, litLengths, hlit);
+	memcpy(all + hlit, distLengths, hdist);
+	int total = hlit + hdist;
+	vector<pair<unsigned char, unsigned char> > runs;
+	uint32_t clFreq[19] = { 0 };
+	for (int i = 0; i < total;)
+	{
+		int len = all[i], run = 1;
+		while (i + run < total && all[i + run] == len) run++;
+		i += run;
+		if (len == 0)
+		{
+			for (; run >= 11; run -= min(run, 138)) { runs.push_back(make_pair(18, (unsigned char)(min(run, 138) - 11))); clFreq[18]++; }
+			for (; run >= 3; run -= min(run, 10))	{ runs.push_back(make_pair(17, (unsigned char)(min(run, 10) - 3)));   clFreq[17]++; }
+		}
+		else
+		{
+			runs.push_back(make_pair((unsigned char)len, 0)); clFreq[len]++; run--;
+			for (; run >= 3; run -= min(run, 6)) { runs.push_back(make_pair(16, (unsigned char)(min(run, 6) - 3))); clFreq[16]++; }
+		}
+		for (; run > 0; run--) { runs.push_back(make_pair((unsigned char)len, 0)); clFreq[len]++; }
+	}
+	ensureTwoSymbols(clFreq, 19);
+	unsigned char clLengths[19];
+	buildLengths(clFreq, 19, 7, clLengths);
+	int hclen = 19;
+	while (hclen > 4 && !clLengths[kCodeLengthOrder[hclen - 1]]) hclen--;
+
+	//size in bits of the dynamic block against the stored one
+	uint64_t bits = 3 + 14 + 3 * hclen;
+	for (int i = 0; i < 19; ++i) bits += (uint64_t)clFreq[i] * clLengths[i];
+	bits += 2 * clFreq[16] + 3 * clFreq[17] + 7 * clFreq[18];
+	for (int i = 0; i < 286; ++i) bits += (uint64_t)litFreq[i] * (litLengths[i] + (i > 256 ? kLengthExtra[i - 257] : 0));
+	for (int i = 0; i < 30; ++i) bits += (uint64_t)distFreq[i] * (distLengths[i] + kDistExtra[i]);
+	if (bits / 8 > size + 5 * (size / kStoredMax + 1))
+	{
+		writeStored(writer, data, size);
+		return;
+	}
+
+	unsigned short litCodes[286], distCodes[30], clCodes[19];
+	buildCodes(litLengths, 286, litCodes);
+	buildCodes(distLengths, 30, distCodes);
+	buildCodes(clLengths, 19, clCodes);
+
+	writer.put(2 << 1, 3); //not final, dynamic
+	writer.put(hlit - 257, 5);
+	writer.put(hdist - 1, 5);
+	writer.put(hclen - 4, 4);
+	for (int i = 0; i < hclen; ++i) writer.put(clLengths[kCodeLengthOrder[i]], 3);
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		int symbol = runs[i].first;
+		writer.put(clCodes[symbol], clLengths[symbol]);
+		if (symbol == 16) writer.put(runs[i].second, 2);
+		else if (symbol == 17) writer.put(runs[i].second, 3);
+		else if (symbol == 18) writer.put(runs[i].second, 7);
+	}
+
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		const Token& t = tokens[i];
+		if (!t.dist)
+		{
+			writer.put(litCodes[t.litLen], litLengths[t.litLen]);
+			continue;
+		}
+		int lc = kTables.lengthCode[t.litLen], dc = distCode(t.dist);
+		writer.put(litCodes[257 + lc], litLengths[257 + lc]);
+		if (kLengthExtra[lc]) writer.put(t.litLen - kLengthBase[lc], kLengthExtra[lc]);
+		writer.put(distCodes[dc], distLengths[dc]);
+		if (kDistExtra[dc]) writer.put(t.dist - kDistBase[dc], kDistExtra[dc]);
+	}
+	writer.put(litCodes[256], litLengths[256]);
+}
+
+static inline uint32_t hash4(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+/* Length of the common prefix of a and b, up to maxLength*/
+static inline int matchLength(const unsigned char* a, const unsigned char* b, int maxLength)
+{
+	int len = 0;
+	for (; len + 8 <= maxLength; len += 8)
+	{
+		uint64_t x, y;
+		memcpy(&x, a + len, 8);
+		memcpy(&y, b + len, 8);
+		if (x != y) break;
+	}
+	while (len < maxLength && a[len] == b[len]) len++;
+	return len;
+}
+
+void deflateSync(const unsigned char* data, size_t size, int level, vector<unsigned char>& out)
+{
+	BitWriter writer(out);
+	if (level <= 0)
+	{
+		if (size) writeStored(writer, data, size);
+	}
+	else
+	{
+		//Greedy matching. With a single candidate the positions inside the matches are not hashed.
+		int maxChain = 1 << (min(level, 9) - 1);
+		vector<int> head(1 << kHashBits, -1);
+		vector<int> prev(maxChain > 1 ? kWindow : 0);
+		vector<Token> tokens;
+		tokens.reserve(kBlockTokens);
+
+		size_t blockStart = 0, pos = 0;
+		while (pos < size)
+		{
+			int bestLength = 0, bestDist = 0;
+			int maxLength = (int)min((size_t)kMaxMatch, size - pos);
+			if (maxLength >= kMinMatch)
+			{
+				uint32_t h = hash4(data + pos);
+				int candidate = head[h];
+				head[h] = (int)pos;
+				if (maxChain > 1) prev[pos & (kWindow - 1)] = candidate;
+				for (int chain = maxChain; candidate >= 0 && pos - candidate <= kWindow && chain > 0; --chain)
+				{
+					int len = matchLength(data + candidate, data + pos, maxLength);
+					if (len > bestLength)
+					{
+						bestLength = len;
+						bestDist = (int)(pos - candidate);
+						if (len == maxLength) break;
+					}
+					if (maxChain == 1) break;
+					int next = prev[candidate & (kWindow - 1)];
+					if (next >= candidate) break; //overwritten by a newer position
+					candidate = next;
+				}
+			}
+
+			Token t;
+			if (bestLength >= kMinMatch)
+			{
+				t.litLen = (unsigned short)bestLength;
+				t.dist = (unsigned short)bestDist;
+				if (maxChain > 1)
+				{
+					size_t end = min(pos + bestLength, size - kMinMatch + 1);
+					for (size_t p = pos + 1; p < end; ++p)
+					{
+						uint32_t hp = hash4(data + p);
+						prev[p & (kWindow - 1)] = head[hp];
+						head[hp] = (int)p;
+					}
+				}
+				pos += bestLength;
+			}
+			else
+			{
+				t.litLen = data[pos];
+				t.dist = 0;
+				pos++;
+			}
+			tokens.push_back(t);
+
+			if (tokens.size() == kBlockTokens || pos == size)
+			{
+				writeBlock(writer, tokens, data + blockStart, pos - blockStart);
+				tokens.clear();
+				blockStart = pos;
+			}
+		}
+	}
+
+	//sync flush
+	writer.put(0, 3);
+	writer.alignByte();
+	static const unsigned char kSync[4] = { 0x00, 0x00, 0xFF, 0xFF };
+	out.insert(out.end(), kSync, kSync + 4);
+}
+
+uint32_t adler32(uint32_t adler, const unsigned char* data, size_t size)
+{
+	static const uint32_t kBase = 65521;
+	static const size_t kMaxRun = 5552; //bytes before the sums can overflow
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while (size)
+	{
+		size_t run = min(size, kMaxRun);
+		size -= run;
+		for (; run >= 4; run -= 4, data += 4)
+		{
+			a += data[0]; b += a;
+			a += data[1]; b += a;
+			a += data[2]; b += a;
+			a += data[3]; b += a;
+		}
+		for (; run; --run) { a += *data++; b += a; }
+		a %= kBase;
+		b %= kBase;
+	}
+	return (b << 16) | a;
+}
+
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2)
+{
+	static const uint32_t kBase = 65521;
+	uint32_t rem = (uint32_t)(size2 % kBase);
+	uint32_t a1 = adler1 & 0xFFFF, b1 = adler1 >> 16;
+	uint32_t a2 = adler2 & 0xFFFF, b2 = adler2 >> 16;
+	uint32_t a = (a1 + a2 + kBase - 1) % kBase;
+	uint32_t b = (uint32_t)(((uint64_t)rem * a1 + b1 + b2 + kBase - rem) % kBase);
+	return (b << 16) | a;
+}
+
+uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size)
+{
+	const uint32_t (*t)[256] = kTables.crc;
+	crc = ~crc;
+	for (; size >= 8; size -= 8, data += 8)
+	{
+		uint32_t lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+		uint32_t hi = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+			  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+	}
+	for (; size; --size) crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace CGCore
+{
+
+/*
+* Raw deflate of data[0, size), appended to out. None of the blocks is final and the stream ends on a byte
+* boundary with an empty stored block (a sync flush), so streams deflated independently can be concatenated.
+* kDeflateFinalBlock closes the concatenation.
+* Level 0 stores the data. Levels 1 to 9 compress with dynamic Huffman blocks, looking at up to
+* 2^(level - 1) earlier positions for each match.
+*/
+void deflateSync(const unsigned char* data, size_t size, int level, std::vector<unsigned char>& out);
+
+/* An empty final block with fixed codes*/
+static const unsigned char kDeflateFinalBlock[2] = { 0x03, 0x00 };
+
+uint32_t adler32(uint32_t adler, const unsigned char* data, size_t size);
+
+/* Adler-32 of the concatenation of two buffers from their checksums, size2 is the size of the second one*/
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2);
+
+/* CRC-32 as used by png and zip, start with crc = 0*/
+uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size);
+
+}
+
+#endif
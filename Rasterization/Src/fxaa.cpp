@@ -0,0 +1,220 @@
+#include "fxaa.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define FXAA_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CGCore
+{
+
+//Pixels whose local luma range is below max(kEdgeThresholdMin, lumaMax >> kEdgeThresholdShift) are left as is
+static const int	kEdgeThresholdMin	= 16;
+static const int	kEdgeThresholdShift = 3;
+//Direction estimation, on the [0, 255] luma scale
+static const float	kReduceMul			= 1.f / 8.f;
+static const float	kReduceMin			= 255.f / 128.f;
+static const float	kSpanMax			= 8.f;
+//Rows processed by a task
+static const size_t kBandRows			= 16;
+
+FXAntialias::FXAntialias() : m_framebuffer(NULL), m_width(0), m_height(0)
+{
+}
+
+void FXAntialias::resize(size_t w, size_t h)
+{
+	m_width = w;
+	m_height = h;
+	m_source.resize(4 * w * h);
+	m_luma.resize(w * h);
+}
+
+/*
+* Antialias the framebuffer in place. The first pass copies the frame and computes its luma,
+* the second one filters the edge pixels, reading only from the copy.
+*/
+void FXAntialias::resolve(unsigned char *framebuffer)
+{
+	m_framebuffer = framebuffer;
+	if (m_width < 3 || m_height < 3) return;
+
+	ThreadPool& pool = ThreadPool::instance();
+	pool.parallelFor(m_height, kBandRows, [this](size_t yBegin, size_t yEnd) { prepareRows(yBegin, yEnd); });
+	pool.parallelFor(m_height, kBandRows, [this](size_t yBegin, size_t yEnd) { filterRows(yBegin, yEnd); });
+}
+
+#ifdef FXAA_SSE2
+/* Luma of the 4 RGBA pixels of p, in the 4 32 bit lanes*/
+static inline __m128i luma4(__m128i p, __m128i weights, __m128i zero)
+{
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights); //77r + 150g, 29b of pixels 0, 1
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights); //pixels 2, 3
+	lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+	hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+	__m128i sum = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0)), 
+									 _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0)));
+	return _mm_srli_epi32(sum, 8);
+}
+#endif
+
+/* Copy the rows to m_source and compute their luma, in one read of the framebuffer*/
+void FXAntialias::prepareRows(size_t yBegin, size_t yEnd)
+{
+	size_t i = yBegin * m_width, end = yEnd * m_width;
+	const unsigned char *pixel = m_framebuffer + 4 * i;
+	unsigned char *source = &m_source[4 * i];
+
+#ifdef FXAA_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+	for (; i + 16 <= end; i += 16, pixel += 64, source += 64)
+	{
+		__m128i p0 = _mm_loadu_si128((const __m128i*)(pixel));
+		__m128i p1 = _mm_loadu_si128((const __m128i*)(pixel + 16));
+		__m128i p2 = _mm_loadu_si128((const __m128i*)(pixel + 32));
+		__m128i p3 = _mm_loadu_si128((const __m128i*)(pixel + 48));
+		_mm_storeu_si128((__m128i*)(source), p0);
+		_mm_storeu_si128((__m128i*)(source + 16), p1);
+		_mm_storeu_si128((__m128i*)(source + 32), p2);
+		_mm_storeu_si128((__m128i*)(source + 48), p3);
+
+		__m128i l01 = _mm_packs_epi32(luma4(p0, weights, zero), luma4(p1, weights, zero));
+		__m128i l23 = _mm_packs_epi32(luma4(p2, weights, zero), luma4(p3, weights, zero));
+		_mm_storeu_si128((__m128i*)&m_luma[i], _mm_packus_epi16(l01, l23));
+	}
+#endif
+	for (; i < end; ++i, pixel += 4, source += 4)
+	{
+		source[0] = pixel[0]; source[1] = pixel[1]; source[2] = pixel[2]; source[3] = pixel[3];
+		m_luma[i] = (uint8_t)((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8);
+	}
+}
+
+/*
+* Find the pixels on an edge and filter them. The 1 pixel border of the frame is left untouched.
+* The contrast test is done on 16 pixels at once with SSE2, most groups have no edge pixel at all.
+*/
+void FXAntialias::filterRows(size_t yBegin, size_t yEnd)
+{
+	int w = m_width;
+	int y0 = max((int)yBegin, 1), y1 = min((int)yEnd, (int)m_height - 1);
+	for (int y = y0; y < y1; ++y)
+	{
+		const uint8_t *up = &m_luma[(y - 1) * w];
+		const uint8_t *mid = up + w;
+		const uint8_t *down = mid + w;
+
+		int x = 1;
+#ifdef FXAA_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i thresholdMin = _mm_set1_epi8((char)kEdgeThresholdMin);
+		const __m128i lowBits = _mm_set1_epi8((char)(0xFF >> kEdgeThresholdShift));
+		for (; x + 16 < w; x += 16)
+		{
+			__m128i nw = _mm_loadu_si128((const __m128i*)(up + x - 1));
+			__m128i ne = _mm_loadu_si128((const __m128i*)(up + x + 1));
+			__m128i sw = _mm_loadu_si128((const __m128i*)(down + x - 1));
+			__m128i se = _mm_loadu_si128((const __m128i*)(down + x + 1));
+			__m128i m  = _mm_loadu_si128((const __m128i*)(mid + x));
+
+			__m128i lumaMax = _mm_max_epu8(_mm_max_epu8(nw, ne), _mm_max_epu8(_mm_max_epu8(sw, se), m));
+			__m128i lumaMin = _mm_min_epu8(_mm_min_epu8(nw, ne), _mm_min_epu8(_mm_min_epu8(sw, se), m));
+			__m128i range = _mm_subs_epu8(lumaMax, lumaMin);
+
+			//8 bit lumaMax >> shift: shift the 16 bit lanes and drop the bits coming from the next byte
+			__m128i threshold = _mm_and_si128(_mm_srli_epi16(lumaMax, kEdgeThresholdShift), lowBits);
+			threshold = _mm_max_epu8(threshold, thresholdMin);
+
+			//range >= threshold
+			int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(threshold, range), zero));
+			for (int i = 0; mask; ++i, mask >>= 1)
+			{
+				if (mask & 1) filterPixel(x + i, y);
+			}
+		}
+#endif
+		for (; x < w - 1; ++x)
+		{
+			int nw = up[x - 1], ne = up[x + 1], sw = down[x - 1], se = down[x + 1], m = mid[x];
+			int lumaMax = max(max(max(nw, ne), max(sw, se)), m);
+			int lumaMin = min(min(min(nw, ne), min(sw, se)), m);
+			if (lumaMax - lumaMin >= max(kEdgeThresholdMin, lumaMax >> kEdgeThresholdShift))
+			{
+				filterPixel(x, y);
+			}
+		}
+	}
+}
+
+void FXAntialias::filterPixel(int x, int y)
+{
+	int w = m_width;
+	const uint8_t *luma = &m_luma[y * w + x];
+	float lumaNW = luma[-w - 1], lumaNE = luma[-w + 1];
+	float lumaSW = luma[ w - 1], lumaSE = luma[ w + 1];
+	float lumaM  = luma[0];
+	float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+	float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+	//Direction along the edge, scaled so its smallest component is about 1 pixel
+	float dirX = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+	float dirY =  ((lumaNW + lumaSW) - (lumaNE + lumaSE));
+	float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25f * kReduceMul), kReduceMin);
+	float rcpDirMin = 1.f / (min(fabs(dirX), fabs(dirY)) + dirReduce);
+	dirX = min(kSpanMax, max(-kSpanMax, dirX * rcpDirMin));
+	dirY = min(kSpanMax, max(-kSpanMax, dirY * rcpDirMin));
+
+	float cx = x + 0.5f, cy = y + 0.5f;
+	float a0[3], a1[3], b0[3], b1[3];
+	fetch(cx + dirX * (1.f / 3.f - 0.5f), cy + dirY * (1.f / 3.f - 0.5f), a0);
+	fetch(cx + dirX * (2.f / 3.f - 0.5f), cy + dirY * (2.f / 3.f - 0.5f), a1);
+	fetch(cx - dirX * 0.5f, cy - dirY * 0.5f, b0);
+	fetch(cx + dirX * 0.5f, cy + dirY * 0.5f, b1);
+
+	float rgbA[3], rgbB[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		rgbA[c] = 0.5f * (a0[c] + a1[c]);
+		rgbB[c] = 0.5f * rgbA[c] + 0.25f * (b0[c] + b1[c]);
+	}
+
+	//The wide taps crossed another edge, keep the narrow ones
+	float lumaB = (77.f * rgbB[0] + 150.f * rgbB[1] + 29.f * rgbB[2]) / 256.f;
+	const float *rgb = (lumaB < lumaMin || lumaB > lumaMax) ? rgbA : rgbB;
+
+	unsigned char *pixel = m_framebuffer + 4 * (y * w + x);
+	pixel[0] = (unsigned char)(rgb[0] + 0.5f);
+	pixel[1] = (unsigned char)(rgb[1] + 0.5f);
+	pixel[2] = (unsigned char)(rgb[2] + 0.5f);
+}
+
+/* Bilinear tap at (x, y) in pixel units on the copy of the frame, clamped to the frame*/
+void FXAntialias::fetch(float x, float y, float rgb[3]) const
+{
+	float tx = min(max(x - 0.5f, 0.f), (float)(m_width - 1));
+	float ty = min(max(y - 0.5f, 0.f), (float)(m_height - 1));
+	int x0 = (int)tx, y0 = (int)ty;
+	int x1 = min(x0 + 1, (int)m_width - 1), y1 = min(y0 + 1, (int)m_height - 1);
+	float fx = tx - x0, fy = ty - y0;
+
+	const unsigned char *p00 = &m_source[4 * (y0 * m_width + x0)];
+	const unsigned char *p10 = &m_source[4 * (y0 * m_width + x1)];
+	const unsigned char *p01 = &m_source[4 * (y1 * m_width + x0)];
+	const unsigned char *p11 = &m_source[4 * (y1 * m_width + x1)];
+	for (int c = 0; c < 3; ++c)
+	{
+		float top = p00[c] + fx * (p10[c] - p00[c]);
+		float bottom = p01[c] + fx * (p11[c] - p01[c]);
+		rgb[c] = top + fy * (bottom - top);
+	}
+}
+
+}
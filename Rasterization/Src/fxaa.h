@@ -0,0 +1,41 @@
+#ifndef FAST_APPROXIMATE_ANTIALIASING
+#define FAST_APPROXIMATE_ANTIALIASING
+
+#include <vector>
+#include <cstdint>
+
+namespace CGCore
+{
+
+/*
+* FXAA resolver, a cheaper alternative to MLAntialias.
+* It is the single pass "console" variant of FXAA: the edge direction is estimated from the 4 diagonal lumas
+* and every edge pixel is blended with 4 bilinear taps along the edge, so the cost per pixel is fixed.
+* The frame is processed in bands of rows on the thread pool. Like MLAntialias, the object is owned
+* by the renderer and its buffers are only allocated in resize().
+*/
+class FXAntialias
+{
+public:
+	FXAntialias();
+
+	void resize(size_t w, size_t h);
+
+	void resolve(unsigned char *framebuffer);
+
+private:
+	void prepareRows(size_t yBegin, size_t yEnd);
+	void filterRows(size_t yBegin, size_t yEnd);
+	void filterPixel(int x, int y);
+	void fetch(float x, float y, float rgb[3]) const;
+
+	unsigned char*				m_framebuffer;
+	size_t						m_width;
+	size_t						m_height;
+	std::vector<unsigned char>	m_source; //copy of the frame the taps read from
+	std::vector<uint8_t>		m_luma;
+};
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "mapped-file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace CGCore
+{
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : m_data(NULL), m_size(0), m_open(false), m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+{
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+	if (!path) return false;
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || (unsigned long long)size.QuadPart > (size_t)-1)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_size = (size_t)size.QuadPart;
+	m_open = true;
+	if (m_size == 0) return true; //empty files can't be mapped
+
+	m_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping) m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_data)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+	m_data = NULL;
+	m_size = 0;
+	m_open = false;
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : m_data(NULL), m_size(0), m_open(false)
+{
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+	if (!path) return false;
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		::close(fd);
+		return false;
+	}
+	m_size = (size_t)st.st_size;
+	if (m_size > 0)
+	{
+		void* data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(fd);
+			m_size = 0;
+			return false;
+		}
+		//the whole file is read once, front to back
+		madvise(data, m_size, MADV_SEQUENTIAL);
+		m_data = (const unsigned char*)data;
+	}
+	//the mapping stays valid without the descriptor
+	::close(fd);
+	m_open = true;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data) munmap((void*)m_data, m_size);
+	m_data = NULL;
+	m_size = 0;
+	m_open = false;
+}
+
+#endif
+
+MappedFile::MappedFile(const char* path) : MappedFile()
+{
+	open(path);
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+}
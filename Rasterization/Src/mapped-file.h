@@ -0,0 +1,47 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+namespace CGCore
+{
+
+/*
+* Read only memory mapping of a whole file. The loaders parse straight from the mapped pages, so the
+* file is neither copied into a buffer nor held twice in memory next to the page cache.
+* Empty files open with a NULL data().
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	explicit MappedFile(const char* path);
+	~MappedFile();
+
+	/* Map the file at path, unmapping the current one. Returns false if it can't be opened.*/
+	bool open(const char* path);
+
+	void close();
+
+	bool isOpen() const { return m_open; }
+
+	const unsigned char* data() const { return m_data; }
+
+	size_t size() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&);			  //not copyable
+	void operator=(const MappedFile&);
+
+	const unsigned char* m_data;
+	size_t				 m_size;
+	bool				 m_open;
+#ifdef _WIN32
+	void*				 m_file;	//HANDLE
+	void*				 m_mapping; //HANDLE
+#endif
+}; // class MappedFile
+
+}
+
+#endif
@@ -1,141 +1,308 @@
 #include "mlaa.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cmath>
 
 using namespace std;
 
 namespace CGCore
 {
 
-MLAntialias::MLAntialias(unsigned char *framebuffer, size_t w, size_t h) 
-	: m_framebuffer(framebuffer), m_height(h), m_width(w)
+MLAntialias::MLAntialias() 
+	: m_framebuffer(NULL), m_height(0), m_width(0), m_rowWords(0), m_colWords(0), m_guided(true), 
+	  m_detection(DETECT_RGB), m_threshold(kRGBThreshold), m_allocations(0)
 {
-	findAPrimaryEdges();
 }
 
-#define IS_EDGE(PIXEL1, PIXEL2) \
-	(abs((PIXEL1)[0] - (PIXEL2)[0]) > 16 || \
-	 abs((PIXEL1)[1] - (PIXEL2)[1]) > 16 || \
-	 abs((PIXEL1)[2] - (PIXEL2)[2]) > 16)
+/*
+* Size the edge bit planes for a w * h framebuffer. This is the only place the resolver allocates memory.
+*/
+void MLAntialias::resize(size_t w, size_t h)
+{
+	m_width = w;
+	m_height = h;
+	m_rowWords = (w + 31) / 32;
+	m_colWords = (h + 31) / 32;
+
+	size_t hSize = h > 1 ? (h - 1) * m_rowWords : 0;
+	size_t vSize = w > 1 ? (w - 1) * m_colWords : 0;
+	if (hSize > m_hEdges.capacity() || vSize > m_vEdges.capacity() ||
+		h > m_markMin.capacity() || w > m_vMin.capacity() || w * h > m_luma.capacity())
+	{
+		++m_allocations;
+	}
+	m_hEdges.assign(hSize, 0);
+	m_vEdges.assign(vSize, 0);
+	m_markMin.assign(h, INT_MAX);
+	m_markMax.assign(h, -1);
+	m_vMin.assign(w, INT_MAX);
+	m_vMax.assign(w, -1);
+	m_luma.resize(w * h);
+}
 
-void MLAntialias::findAPrimaryEdges()
+/*
+* Mark the pixels around the segment (x0, y0) - (x1, y1) as edge pixels.
+* For each row the segment crosses, its x extent on that row is marked (one pixel wider on both sides), 
+* on that row and on the two rows next to it, since the segment may decide the coverage of their pixel centers.
+*/
+void MLAntialias::markSegment(float x0, float y0, float x1, float y1)
 {
-	for (int yPri = 0; yPri < m_height - 1; ++yPri)
+	if (y0 > y1) { std::swap(x0, x1); std::swap(y0, y1); }
+	if (!(y0 <= y1) || !(x0 == x0) || !(x1 == x1)) return; //NaN
+
+	float dxdy = (y1 != y0) ? (x1 - x0) / (y1 - y0) : 0.f;
+	float yBegin = std::max(floor(y0), -1.f);
+	float yEnd = std::min(floor(y1), (float)m_height);
+
+	for (float row = yBegin; row <= yEnd; row += 1.f)
 	{
-		//Find a primary edge
-		int xPriBegin, xPriEnd;
-		for (xPriBegin = xPriEnd = 0; xPriEnd < m_width; ++xPriEnd)
+		float ya = std::max(y0, row), yb = std::min(y1, row + 1.f);
+		float xa = (y1 != y0) ? x0 + (ya - y0) * dxdy : x0;
+		float xb = (y1 != y0) ? x0 + (yb - y0) * dxdy : x1;
+
+		float xl = std::max(floor(std::min(xa, xb)) - 1.f, -1.f);
+		float xr = std::min(floor(std::max(xa, xb)) + 1.f, (float)m_width);
+		int iy = (int)row;
+		markSpan(iy - 1, (int)xl, (int)xr);
+		markSpan(iy,	 (int)xl, (int)xr);
+		markSpan(iy + 1, (int)xl, (int)xr);
+	}
+}
+
+/* Edge test between the pixels of index a and b, on the RGB channels*/
+struct RGBEdge
+{
+	const unsigned char *framebuffer;
+	int threshold;
+	inline bool operator()(size_t a, size_t b) const
+	{
+		const unsigned char *p1 = framebuffer + 4 * a, *p2 = framebuffer + 4 * b;
+		return	abs(p1[0] - p2[0]) > threshold ||
+				abs(p1[1] - p2[1]) > threshold ||
+				abs(p1[2] - p2[2]) > threshold;
+	}
+};
+
+/* Edge test between the pixels of index a and b, on the luma plane*/
+struct LumaEdge
+{
+	const uint8_t *luma;
+	int threshold;
+	inline bool operator()(size_t a, size_t b) const
+	{
+		return abs(luma[a] - luma[b]) > threshold;
+	}
+};
+
+/*
+* The range [xBegin, xEnd) of row y of m_hEdges to examine, word aligned. 
+* A horizontal edge between row y and y + 1 needs a marked pixel on one of the two rows.
+*/
+bool MLAntialias::hRange(int y, int& xBegin, int& xEnd) const
+{
+	int lo = std::min(m_markMin[y], m_markMin[y + 1]);
+	int hi = std::max(m_markMax[y], m_markMax[y + 1]);
+	if (lo > hi) return false;
+
+	xBegin = lo & ~31;
+	xEnd = std::min((hi | 31) + 1, (int)m_width);
+	return true;
+}
+
+/*
+* Compute the luma (BT.601, 8 bits fixed point weights) of the pixels the detection will read:
+* the marked spans of a row and of the rows above and below it, word aligned.
+*/
+void MLAntialias::computeLuma()
+{
+	int w = m_width, h = m_height;
+	for (int y = 0; y < h; ++y)
+	{
+		int lo = m_markMin[y], hi = m_markMax[y];
+		if (y > 0)	   { lo = std::min(lo, m_markMin[y - 1]); hi = std::max(hi, m_markMax[y - 1]); }
+		if (y + 1 < h) { lo = std::min(lo, m_markMin[y + 1]); hi = std::max(hi, m_markMax[y + 1]); }
+		if (lo > hi) continue;
+
+		int xBegin = std::max((lo & ~31) - 1, 0);
+		int xEnd = std::min((hi | 31) + 2, w);
+		const unsigned char *pixel = m_framebuffer + 4 * (y * w + xBegin);
+		uint8_t *luma = &m_luma[y * w];
+		for (int x = xBegin; x < xEnd; ++x, pixel += 4)
 		{
+			luma[x] = (uint8_t)((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8);
+		}
+	}
+}
 
-			unsigned char * topPixel = &m_framebuffer[0] + 4 * (xPriEnd + yPri * m_width);
-			unsigned char * bottomPixel = &m_framebuffer[0] + 4 * (xPriEnd + (yPri + 1) * m_width);
+/*
+* Fill the two edge bit planes inside the marked regions. 
+* Each row is read once, every pixel is compared with its bottom and right neighbour.
+*/
+template<class IsEdge>
+void MLAntialias::findAPrimaryEdges(IsEdge isEdge)
+{
+	int w = m_width, h = m_height;
+	for (int y = 0; y < h; ++y)
+	{
+		size_t row = (size_t)y * w;
+		size_t nextRow = row + w;
 
-			if (!IS_EDGE(topPixel, bottomPixel))
+		int xBegin, xEnd;
+		if (y + 1 < h && hRange(y, xBegin, xEnd))
+		{
+			uint32_t *words = &m_hEdges[y * m_rowWords];
+			uint32_t word = 0;
+			for (int x = xBegin; x < xEnd; ++x)
 			{
-				if (xPriBegin == xPriEnd)
-					++xPriBegin;
-				else
+				if (isEdge(row + x, nextRow + x))
+					word |= 1u << (x & 31);
+
+				if ((x & 31) == 31 || x + 1 == xEnd)
 				{
-					//printf("Begin (%d, %d) End (%d, %d)\n", xPriBegin, yPri, xPriEnd, yPri);
-					bool isEdgel = false;
-					if (xPriBegin != 0)
-					{
-						unsigned char * pl = m_framebuffer + 4 * (xPriBegin - 1 + yPri * m_width);
-						unsigned char * pr = m_framebuffer + 4 * (xPriBegin + yPri * m_width);
-						isEdgel = IS_EDGE(pl, pr);
-					}
-					unsigned char * pl = m_framebuffer + 4 * (xPriEnd - 1 + yPri * m_width);
-					unsigned char * pr = m_framebuffer + 4 * (xPriEnd     + yPri * m_width);
-					bool isEdger = IS_EDGE(pl, pr);
-					m_rowEdges.emplace_back(xPriBegin, xPriEnd, yPri, isEdgel, isEdger);
-					
-					xPriBegin = xPriEnd;
-					++xPriBegin;
+					words[x >> 5] = word;
+					word = 0;
 				}
 			}
 		}
 
-		if (xPriBegin != xPriEnd)
+		if (m_markMin[y] <= m_markMax[y])
 		{
-			//printf("Begin (%d, %d) End (%d, %d)\n", xPriBegin, yPri, xPriEnd, yPri);
-			//antialiasEdge(xPriBegin, yPri, xPriEnd, yPri);
-			bool isEdgel = false;
-			if (xPriBegin != 0)
+			//A vertical edge between x and x + 1 needs one of them marked
+			xBegin = std::max(m_markMin[y] - 1, 0);
+			xEnd = std::min(m_markMax[y] + 1, w - 1);
+			for (int x = xBegin; x < xEnd; ++x)
 			{
-				unsigned char * pl = m_framebuffer + 4 * (xPriBegin - 1 + yPri * m_width);
-				unsigned char * pr = m_framebuffer + 4 * (xPriBegin + yPri * m_width);
-				isEdgel = IS_EDGE(pl, pr);
+				if (isEdge(row + x, row + x + 1))
+				{
+					m_vEdges[x * m_colWords + (y >> 5)] |= 1u << (y & 31);
+					m_vMin[x] = std::min(m_vMin[x], y);
+					m_vMax[x] = y;
+				}
 			}
-			bool isEdger = false;
-			m_rowEdges.emplace_back(xPriBegin, xPriEnd, yPri, isEdgel, isEdger);
 		}
 	}
+}
 
-	for (int xPri = 0; xPri < m_width - 1; ++xPri)
+/*
+* Zero the words of the bit planes written by findAPrimaryEdges() and drop the marks.
+*/
+void MLAntialias::clearEdges()
+{
+	int w = m_width, h = m_height;
+	for (int y = 0; y + 1 < h; ++y)
 	{
-		//Find a primary edge
-		int yPriBegin, yPriEnd;
-		for (yPriBegin = yPriEnd = 0; yPriEnd < m_height; ++yPriEnd)
+		int xBegin, xEnd;
+		if (hRange(y, xBegin, xEnd))
 		{
-
-			unsigned char * leftPixel = &m_framebuffer[0] + 4 * (xPri + yPriEnd * m_width);
-			unsigned char * rightPixel = &m_framebuffer[0] + 4 * (xPri + 1 + yPriEnd * m_width);
-
-			if (!IS_EDGE(leftPixel, rightPixel))
-			{
-				if (yPriBegin == yPriEnd)
-					++yPriBegin;
-				else
-				{
-					//printf("Begin (%d, %d) End (%d, %d)\n", xPri, yPriBegin, xPri, yPriEnd);
-					bool isEdget = false;
-					if (yPriBegin != 0)
-					{
-						unsigned char * pt = m_framebuffer + 4 * (xPri + (yPriBegin - 1) * m_width);
-						unsigned char * pb = m_framebuffer + 4 * (xPri + yPriBegin * m_width);
-						isEdget = IS_EDGE(pt, pb);
-					}
-					unsigned char * pt = m_framebuffer + 4 * (xPri + (yPriEnd - 1) * m_width);
-					unsigned char * pb = m_framebuffer + 4 * (xPri + yPriEnd * m_width);
-					bool isEdgeb = IS_EDGE(pt, pb);
-					m_colEdges.emplace_back(yPriBegin, yPriEnd, xPri,isEdget, isEdgeb);
-					//antialiasEdge(xPriBegin, yPri, xPriEnd, yPri);
-					yPriBegin = yPriEnd;
-					++yPriBegin;
-				}
-			}
+			uint32_t *words = &m_hEdges[y * m_rowWords];
+			fill(words + (xBegin >> 5), words + ((xEnd - 1) >> 5) + 1, 0);
 		}
+	}
 
-		if (yPriBegin != yPriEnd)
+	for (int x = 0; x + 1 < w; ++x)
+	{
+		if (m_vMin[x] <= m_vMax[x])
 		{
-			bool isEdget = false;
-			if (yPriBegin != 0)
-			{
-				unsigned char * pt = m_framebuffer + 4 * (xPri + (yPriBegin - 1) * m_width);
-				unsigned char * pb = m_framebuffer + 4 * (xPri + yPriBegin * m_width);
-				isEdget = IS_EDGE(pt, pb);
-			}
-			bool isEdgeb = false;
-			//printf("Begin (%d, %d) End (%d, %d)\n", xPri, yPriBegin, xPri, yPriEnd);
-			m_colEdges.emplace_back(yPriBegin, yPriEnd, xPri, isEdget, isEdgeb);;
-			//antialiasEdge(xPriBegin, yPri, xPriEnd, yPri);
+			uint32_t *words = &m_vEdges[x * m_colWords];
+			fill(words + (m_vMin[x] >> 5), words + (m_vMax[x] >> 5) + 1, 0);
+			m_vMin[x] = INT_MAX;
+			m_vMax[x] = -1;
 		}
 	}
+
+	clearMarks();
 }
 
-void MLAntialias::resolve()
+void MLAntialias::clearMarks()
 {
-	for (size_t i = 0; i < m_rowEdges.size(); ++i)
+	fill(m_markMin.begin(), m_markMin.end(), INT_MAX);
+	fill(m_markMax.begin(), m_markMax.end(), -1);
+}
+
+/*
+* Call f(begin, end) for each run [begin, end) of set bits in bits[first, last).
+* Empty words are skipped 32 bits at a time.
+*/
+template<class F>
+static void forEachRun(const uint32_t *bits, int first, int last, F f)
+{
+	int i = first;
+	while (i < last)
+	{
+		uint32_t word = bits[i >> 5] >> (i & 31);
+		if (word == 0) { i = (i | 31) + 1; continue; }
+		if (!(word & 1)) { ++i; continue; }
+
+		int begin = i;
+		while (i < last && ((bits[i >> 5] >> (i & 31)) & 1)) ++i;
+		f(begin, i);
+	}
+}
+
+void MLAntialias::resolve(unsigned char *framebuffer)
+{
+#ifdef _DEBUG
+	const uint32_t *hData = m_hEdges.empty() ? NULL : &m_hEdges[0];
+	const uint32_t *vData = m_vEdges.empty() ? NULL : &m_vEdges[0];
+	size_t allocations = m_allocations;
+#endif
+
+	m_framebuffer = framebuffer;
+	if (m_width < 2 || m_height < 2) return;
+
+	if (!m_guided)
 	{
-		antialiasRowEdge(m_rowEdges[i].begin, m_rowEdges[ i ].end, m_rowEdges[ i ].pri,
-			m_rowEdges[i].isEdgeBegin, m_rowEdges[i].isEdgeEnd);
+		fill(m_markMin.begin(), m_markMin.end(), 0);
+		fill(m_markMax.begin(), m_markMax.end(), (int)m_width - 1);
 	}
 
-	for (size_t i = 0; i < m_colEdges.size();  ++i)
+	if (m_detection == DETECT_LUMA)
 	{
-		antialiasColEdge(m_colEdges[i].begin, m_colEdges[i].end, m_colEdges[i].pri,
-			m_colEdges[i].isEdgeBegin, m_colEdges[i].isEdgeEnd);
+		computeLuma();
+		LumaEdge isEdge = { &m_luma[0], m_threshold };
+		findAPrimaryEdges(isEdge);
 	}
+	else
+	{
+		RGBEdge isEdge = { m_framebuffer, m_threshold };
+		findAPrimaryEdges(isEdge);
+	}
+
+	int w = m_width, h = m_height;
+	for (int yPri = 0; yPri < h - 1; ++yPri)
+	{
+		int xFirst, xLast;
+		if (!hRange(yPri, xFirst, xLast)) continue;
+
+		forEachRun(&m_hEdges[yPri * m_rowWords], xFirst, xLast, [&](int xBegin, int xEnd)
+		{
+			bool isEdgeBegin = xBegin != 0 && vEdge(xBegin - 1, yPri);
+			bool isEdgeEnd = xEnd != w && vEdge(xEnd - 1, yPri);
+			antialiasRowEdge(xBegin, xEnd, yPri, isEdgeBegin, isEdgeEnd);
+		});
+	}
+
+	for (int xPri = 0; xPri < w - 1; ++xPri)
+	{
+		if (m_vMin[xPri] > m_vMax[xPri]) continue;
+
+		forEachRun(&m_vEdges[xPri * m_colWords], m_vMin[xPri], m_vMax[xPri] + 1, [&](int yBegin, int yEnd)
+		{
+			bool isEdgeBegin = yBegin != 0 && hEdge(xPri, yBegin - 1);
+			bool isEdgeEnd = yEnd != h && hEdge(xPri, yEnd - 1);
+			antialiasColEdge(yBegin, yEnd, xPri, isEdgeBegin, isEdgeEnd);
+		});
+	}
+
+	clearEdges();
+
+#ifdef _DEBUG
+	//The resolver must not allocate per frame: the edge planes are the same buffers as before
+	_ASSERT(allocations == m_allocations);
+	_ASSERT(hData == (m_hEdges.empty() ? NULL : &m_hEdges[0]));
+	_ASSERT(vData == (m_vEdges.empty() ? NULL : &m_vEdges[0]));
+#endif
 }
 
 #define UPDATE_PIXEL(PIXELTO, PIXELFROM, A) \
@@ -182,10 +349,6 @@ void MLAntialias::antialiasRowEdge(int xBegin, int xEnd, int yPri, bool isEdgeBe
 	if (xEnd != m_width)
 	{
 		//right L
-		unsigned char * pl = m_framebuffer + 4 * (x2 + y0 * m_width);
-		unsigned char * pr = m_framebuffer + 4 * (x3 + y0 * m_width);
-		bool isEdge = IS_EDGE(pl, pr);
-
 		int yTo = isEdgeEnd ? y0 : y1;
 		int yFrom = isEdgeEnd ? y1 : y0;
 
@@ -228,10 +391,6 @@ void MLAntialias::antialiasColEdge(int yBegin, int yEnd, int xPri, bool isEdgeBe
 	//top L
 	if (yBegin != 0)
 	{
-		unsigned char * pt = m_framebuffer + 4 * (x0 + y0 * m_width);
-		unsigned char * pb = m_framebuffer + 4 * (x0 + y1 * m_width);
-		bool isEdge = IS_EDGE(pt, pb);
-
 		int xTo = (isEdgeBegin) ? x0 : x1;
 		int xFrom = (isEdgeBegin) ? x1 : x0;
 
@@ -257,11 +416,6 @@ void MLAntialias::antialiasColEdge(int yBegin, int yEnd, int xPri, bool isEdgeBe
 	//bottom L
 	if (yEnd != m_height)
 	{
-
-		unsigned char * pt = m_framebuffer + 4 * (x0 + y2 * m_width);
-		unsigned char * pb = m_framebuffer + 4 * (x0 + y3 * m_width);
-		bool isEdge = IS_EDGE(pt, pb);
-
 		int xTo = (isEdgeEnd) ? x0 : x1;
 		int xFrom = (isEdgeEnd) ? x1 : x0;
 
@@ -2,42 +2,118 @@
 #define MORPHOLOGICAL_ANTIALIASING
 
 #include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <climits>
 
 namespace CGCore
 {
 
+/*
+* Morphological antialiasing resolver.
+* The object is owned by the renderer and lives across frames. All the edge storage is sized in resize(),
+* resolve() only reuses it, so no heap allocation happens per frame.
+* Primary edges are stored as two bit planes (1 bit per pixel each) instead of a list of edge runs:
+*  m_hEdges: row major, bit x of row y is set if pixel (x, y) differs from pixel (x, y + 1).
+*  m_vEdges: column major, bit y of column x is set if pixel (x, y) differs from pixel (x + 1, y).
+* The edge runs are extracted from the bit planes while resolving.
+*
+* When geometry guided (the default) only the pixels the rasterizer marked as shape edges are examined.
+* The marks are kept as one [min, max] span per row, a color discontinuity between two pixels always has one
+* marked pixel, so the edges can only be found inside the spans (or next to them).
+* The bit planes are cleared again after each resolve, only where they were written.
+*
+* Two pixels are on an edge if one of their RGB channels differs by more than the threshold (DETECT_RGB), or
+* if their luma differs by more than the threshold (DETECT_LUMA). In luma mode an 8 bit luma plane is computed 
+* once per frame for the examined rows, the detection passes then read 1 byte per pixel instead of 4.
+*/
 class MLAntialias
 {
 public:
-	MLAntialias(unsigned char *framebuffer, size_t w, size_t h);
-	
+	enum EdgeDetection
+	{
+		DETECT_RGB = 0,
+		DETECT_LUMA,
+	};
 
-	void resolve();
+	//Default thresholds. A difference of 16 on a single channel is a luma difference of 2 to 9
+	static const int kRGBThreshold  = 16;
+	static const int kLumaThreshold = 8;
 
-private:
-	struct Edge
+	MLAntialias();
+
+	void resize(size_t w, size_t h);
+
+	void resolve(unsigned char *framebuffer);
+
+	/* Restrict edge detection to the marked regions, or scan the whole framebuffer*/
+	void setGeometryGuided(bool guided) { m_guided = guided; }
+
+	/* Select what the edge detection compares, and the difference above which two pixels are on an edge*/
+	void setEdgeDetection(EdgeDetection detection, int threshold)
 	{
-		int begin;
-		int end;
-		int pri;
-		bool isEdgeBegin;
-		bool isEdgeEnd;
-		Edge(int b, int e, int p, bool iseb, bool ised) :
-			begin(b), end(e), pri(p), isEdgeBegin(iseb), isEdgeEnd(ised)
-		{
-		}
-	};
-	void findAPrimaryEdges();
+		m_detection = detection;
+		m_threshold = threshold;
+	}
+
+	EdgeDetection edgeDetection() const { return m_detection; }
+
+	/* Mark the pixels x0..x1 of row y as shape edge pixels*/
+	inline void markSpan(int y, int x0, int x1)
+	{
+		if (y < 0 || y >= (int)m_height) return;
+		if (x0 < 0) x0 = 0;
+		if (x1 >= (int)m_width) x1 = (int)m_width - 1;
+		if (x0 > x1) return;
+		m_markMin[y] = std::min(m_markMin[y], x0);
+		m_markMax[y] = std::max(m_markMax[y], x1);
+	}
+
+	void markSegment(float x0, float y0, float x1, float y1);
+
+	/* Drop the marks without resolving, when the frame is not antialiased by MLAA*/
+	void clearMarks();
+
+	/* Number of times the edge buffers have been (re)allocated. Only resize() changes it.*/
+	size_t allocationCount() const { return m_allocations; }
+
+private:
+	template<class IsEdge>
+	void findAPrimaryEdges(IsEdge isEdge);
+	void computeLuma();
+	void clearEdges();
+	bool hRange(int y, int& xBegin, int& xEnd) const;
 	void antialiasRowEdge(int xBegin, int xEnd, int yPri, bool isEdgeBegin, bool isEdgeEnd);
 	void antialiasColEdge(int yBegin, int yEnd, int xPri, bool isEdgeBegin, bool isEdgeEnd);
 
-	unsigned char*	  m_framebuffer;
-	size_t			  m_height;
-	size_t			  m_width;
-	std::vector<Edge>  m_rowEdges;
-	std::vector<Edge>  m_colEdges;
+	inline bool hEdge(int x, int y) const
+	{
+		return (m_hEdges[y * m_rowWords + (x >> 5)] >> (x & 31)) & 1;
+	}
+
+	inline bool vEdge(int x, int y) const
+	{
+		return (m_vEdges[x * m_colWords + (y >> 5)] >> (y & 31)) & 1;
+	}
+
+	unsigned char*		   m_framebuffer;
+	size_t				   m_height;
+	size_t				   m_width;
+	size_t				   m_rowWords; //32 bit words per row of m_hEdges
+	size_t				   m_colWords; //32 bit words per column of m_vEdges
+	std::vector<uint32_t>  m_hEdges;
+	std::vector<uint32_t>  m_vEdges;
+	bool				   m_guided;
+	EdgeDetection		   m_detection;
+	int					   m_threshold;
+	std::vector<uint8_t>   m_luma;
+	std::vector<int>	   m_markMin;  //marked pixels span of each row
+	std::vector<int>	   m_markMax;
+	std::vector<int>	   m_vMin;	   //rows with vertical edges of each column
+	std::vector<int>	   m_vMax;
+	size_t				   m_allocations;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
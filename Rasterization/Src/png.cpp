@@ -1,8 +1,20 @@
 #include "png.h"
+#include "deflate.h"
+#include "thread-pool.h"
+#include "mapped-file.h"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define PNG_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace CGCore
 {
@@ -24,6 +36,8 @@ namespace CGCore
 * 2. Altered source versions must be plainly marked as such, and must not be
 *    misrepresented as being the original software.
 * 3. This notice may not be removed or altered from any source distribution.
+*
+* Altered: table driven Huffman decoding with a 64 bit bit buffer, bulk match copies and SSE2 unfiltering.
 */
 int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 
@@ -34,180 +48,192 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 	static const unsigned long CLCL[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 }; //code length code lengths
 	struct Zlib //nested functions for zlib decompression
 	{
-		static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result; }
-		static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
+		enum { FASTBITS = 10 }; //huffman codes up to this length are decoded with a single table lookup
+
+		//Bits of the stream, least significant first, refilled a 64 bit word at a time. Past the end of the input it reads zeros,
+		//exhausted() tells whether any of them were consumed.
+		struct BitReader
 		{
-			unsigned long result = 0;
-			for (size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-			return result;
-		}
-		struct HuffmanTree
+			const unsigned char* in; size_t size, pos; uint64_t bits; unsigned count;
+			BitReader(const unsigned char* in_, size_t size_) : in(in_), size(size_), pos(0), bits(0), count(0) {}
+			void refill() //at least 56 bits in the buffer after
+			{
+				if (pos + 8 <= size)
+				{
+					uint64_t word; memcpy(&word, in + pos, 8); //little endian, as the targets
+					bits |= word << count;
+					pos += (63 - count) >> 3;
+					count |= 56;
+				}
+				else for (; count <= 56; count += 8, pos++) if (pos < size) bits |= (uint64_t)in[pos] << count;
+			}
+			unsigned long peek(unsigned n) const { return (unsigned long)(bits & ((1ull << n) - 1)); }
+			void consume(unsigned n) { bits >>= n; count -= n; }
+			unsigned long read(unsigned n) { if (count < n) refill(); unsigned long result = peek(n); consume(n); return result; }
+			size_t bytePos() const { return pos - count / 8; } //first byte not consumed, once aligned
+			void seek(size_t p) { pos = p; bits = 0; count = 0; }
+			bool exhausted() const { return pos * 8 - count > size * 8; }
+		};
+		struct HuffmanTable
 		{
-			int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-			{ //make tree given the lengths
-				unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-				std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-				for (unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
-				for (unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-				for (unsigned long n = 0; n < numcodes; n++) if (bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-				tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-				for (unsigned long n = 0; n < numcodes; n++) //the codes
-					for (unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
+			unsigned short fast[1 << FASTBITS]; //(symbol << 4) | length of the codes up to FASTBITS bits indexed by their reversed bits, 0 for the longer ones
+			unsigned short counts[16], symbols[288]; //number of codes of each length, the symbols by code order
+			int build(const unsigned char* bitlen, unsigned long numcodes) //make the table given the lengths
+			{
+				memset(counts, 0, sizeof(counts));
+				memset(fast, 0, sizeof(fast));
+				for (unsigned long n = 0; n < numcodes; n++) counts[bitlen[n]]++; //count number of instances of each code length
+				counts[0] = 0;
+				unsigned short offsets[16]; long left = 1;
+				offsets[1] = 0;
+				for (int len = 1; len < 16; len++)
+				{
+					left = (left << 1) - counts[len]; if (left < 0) return 55; //error: over subscribed code lengths
+					if (len < 15) offsets[len + 1] = offsets[len] + counts[len];
+				}
+				for (unsigned long n = 0; n < numcodes; n++) if (bitlen[n]) symbols[offsets[bitlen[n]]++] = (unsigned short)n;
+				unsigned long code = 0, index = 0; //canonical codes, in the order of symbols
+				for (unsigned long len = 1; len <= FASTBITS; len++, code <<= 1)
+					for (unsigned long k = 0; k < counts[len]; k++, code++, index++)
 					{
-						unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-						if (treepos > numcodes - 2) return 55;
-						if (tree2d[2 * treepos + bit] == 32767) //not yet filled in
-						{
-							if (i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-							else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-						}
-						else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
+						unsigned long reversed = 0;
+						for (unsigned long b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+						for (unsigned long i = reversed; i < (1u << FASTBITS); i += (1u << len)) fast[i] = (unsigned short)((symbols[index] << 4) | len);
 					}
 				return 0;
 			}
-			int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-			{ //Decodes a symbol from the tree
-				unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-				if (treepos >= numcodes) return 11; //error: you appeared outside the codetree
-				result = tree2d[2 * treepos + bit];
-				decoded = (result < numcodes);
-				treepos = decoded ? 0 : result - numcodes;
-				return 0;
+			int decode(BitReader& br) const //decode a symbol from the at least 15 bits of br, -1 if no code matches
+			{
+				unsigned long entry = fast[br.peek(FASTBITS)];
+				if (entry) { br.consume(entry & 15); return (int)(entry >> 4); }
+				unsigned long code = 0, first = 0, index = 0;
+				for (unsigned len = 1; len < 16; len++, first <<= 1, code <<= 1)
+				{
+					code |= (unsigned long)(br.bits >> (len - 1)) & 1;
+					if (code - first < counts[len]) { br.consume(len); return symbols[index + code - first]; }
+					index += counts[len]; first += counts[len];
+				}
+				return -1;
 			}
-			std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
 		};
 		struct Inflator
 		{
 			int error;
 			void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
 			{
-				size_t bp = 0, pos = 0; //bit pointer and byte pointer
+				size_t pos = 0; //byte pointer in out
 				error = 0;
+				BitReader br(&in[0] + inpos, in.size() - inpos);
 				unsigned long BFINAL = 0;
 				while (!BFINAL && !error)
 				{
-					if (bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-					BFINAL = readBitFromStream(bp, &in[inpos]);
-					unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
+					BFINAL = br.read(1);
+					unsigned long BTYPE = br.read(2);
+					if (br.exhausted()) { error = 52; return; } //error, bit pointer will jump past memory
 					if (BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-					else if (BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-					else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
+					else if (BTYPE == 0) inflateNoCompression(out, br, pos);
+					else inflateHuffmanBlock(out, br, pos, BTYPE);
 				}
 				if (!error) out.resize(pos); //Only now we know the true size of out, resize it to that
 			}
-			void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
+			void generateFixedTrees(HuffmanTable& tree, HuffmanTable& treeD) //get the tree of a deflated block with fixed tree
 			{
-				std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
-				for (size_t i = 144; i <= 255; i++) bitlen[i] = 9;
-				for (size_t i = 256; i <= 279; i++) bitlen[i] = 7;
-				tree.makeFromLengths(bitlen, 15);
-				treeD.makeFromLengths(bitlenD, 15);
+				unsigned char bitlen[288], bitlenD[32];
+				for (size_t i = 0; i < 288; i++) bitlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+				for (size_t i = 0; i < 32; i++) bitlenD[i] = 5;
+				tree.build(bitlen, 288);
+				treeD.build(bitlenD, 32);
 			}
-			HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-			unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
-			{ //decode a single symbol from given list of bits with given code tree. return value is the symbol
-				bool decoded; unsigned long ct;
-				for (size_t treepos = 0;;)
-				{
-					if ((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-					error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if (error) return 0; //stop, an error happened
-					if (decoded) return ct;
-				}
-			}
-			void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
+			HuffmanTable codetree, codetreeD, codelengthcodetree; //the code tables for Huffman codes, dist codes, and code length codes
+			void getTreeInflateDynamic(HuffmanTable& tree, HuffmanTable& treeD, BitReader& br)
 			{ //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
-				std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-				if (bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-				size_t HLIT = readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-				size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-				size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
-				std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-				for (size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-				error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if (error) return;
-				size_t i = 0, replength;
+				unsigned char bitlen[288 + 32] = { 0 }; //the literal/length code lengths, then the dist code lengths
+				size_t HLIT = br.read(5) + 257; //number of literal/length codes + 257
+				size_t HDIST = br.read(5) + 1; //number of dist codes + 1
+				size_t HCLEN = br.read(4) + 4; //number of code length codes + 4
+				unsigned char codelengthcode[19]; //lengths of tree to decode the lengths of the dynamic tree
+				for (size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (unsigned char)((i < HCLEN) ? br.read(3) : 0);
+				if (br.exhausted()) { error = 49; return; } //the bit pointer is or will go past the memory
+				if (HLIT > 286 || HDIST > 30) { error = 16; return; } //error: somehow an unexisting code appeared
+				error = codelengthcodetree.build(codelengthcode, 19); if (error) return;
+				size_t i = 0;
 				while (i < HLIT + HDIST)
 				{
-					unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if (error) return;
-					if (code <= 15)  { if (i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
-					else if (code == 16) //repeat previous
-					{
-						if (bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-						replength = 3 + readBitsFromStream(bp, in, 2);
-						unsigned long value; //set value to the previous code
-						if ((i - 1) < HLIT) value = bitlen[i - 1];
-						else value = bitlenD[i - HLIT - 1];
-						for (size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-						{
-							if (i >= HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
-							if (i < HLIT) bitlen[i++] = value; else bitlenD[i++ - HLIT] = value;
-						}
-					}
-					else if (code == 17) //repeat "0" 3-10 times
+					br.refill();
+					int code = codelengthcodetree.decode(br);
+					if (code < 0) { error = 11; return; } //error: you appeared outside the codetree
+					if (code <= 15) { bitlen[i++] = (unsigned char)code; continue; } //a length code
+					size_t replength; unsigned char value = 0;
+					if (code == 16) //repeat previous
 					{
-						if (bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-						replength = 3 + readBitsFromStream(bp, in, 3);
-						for (size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-						{
-							if (i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
-							if (i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-						}
-					}
-					else if (code == 18) //repeat "0" 11-138 times
-					{
-						if (bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-						replength = 11 + readBitsFromStream(bp, in, 7);
-						for (size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-						{
-							if (i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
-							if (i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-						}
+						if (i == 0) { error = 54; return; } //error: nothing to repeat
+						replength = 3 + br.read(2); value = bitlen[i - 1];
 					}
+					else if (code == 17) replength = 3 + br.read(3); //repeat "0" 3-10 times
+					else if (code == 18) replength = 11 + br.read(7); //repeat "0" 11-138 times
 					else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
+					if (i + replength > HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
+					memset(&bitlen[i], value, replength); i += replength;
 				}
+				if (br.exhausted()) { error = 50; return; } //error, bit pointer jumps past memory
 				if (bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
-				error = tree.makeFromLengths(bitlen, 15); if (error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
-				error = treeD.makeFromLengths(bitlenD, 15); if (error) return;
+				error = tree.build(bitlen, HLIT); if (error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
+				error = treeD.build(bitlen + HLIT, HDIST); if (error) return;
 			}
-			void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype)
+			void inflateHuffmanBlock(std::vector<unsigned char>& out, BitReader& br, size_t& pos, unsigned long btype)
 			{
 				if (btype == 1) { generateFixedTrees(codetree, codetreeD); }
-				else if (btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if (error) return; }
+				else if (btype == 2) { getTreeInflateDynamic(codetree, codetreeD, br); if (error) return; }
 				for (;;)
 				{
-					unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if (error) return;
-					if (code == 256) return; //end code
-					else if (code <= 255) //literal symbol
+					br.refill(); //enough for a length and a distance: 15 + 5 + 15 + 13 bits
+					int code = codetree.decode(br);
+					if (code < 256) //literal symbol
 					{
+						if (code < 0) { error = 11; return; } //error: you appeared outside the codetree
+						if (br.exhausted()) { error = 10; return; } //error: end reached without endcode
 						if (pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
 						out[pos++] = (unsigned char)(code);
+						continue;
+					}
+					if (code == 256) break; //end code
+					if (code > 285) { error = 11; return; }
+					size_t length = LENBASE[code - 257] + br.read(LENEXTRA[code - 257]);
+					int codeD = codetreeD.decode(br);
+					if (codeD < 0 || codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
+					size_t dist = DISTBASE[codeD] + br.read(DISTEXTRA[codeD]);
+					if (br.exhausted()) { error = 51; return; } //error, bit pointer will jump past memory
+					if (dist > pos) { error = 52; return; } //error: the distance goes back before the start of the output
+					if (pos + length + 8 <= out.size()) //room to copy by 8 bytes, past the end of the match
+					{
+						unsigned char *dst = &out[0] + pos;
+						const unsigned char *src = dst - dist;
+						if (dist >= 8) for (size_t i = 0; i < length; i += 8) memcpy(dst + i, src + i, 8);
+						else if (dist == 1) memset(dst, *src, length);
+						else for (size_t i = 0; i < length; i++) dst[i] = src[i];
 					}
-					else if (code >= 257 && code <= 285) //length code
+					else
 					{
-						size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-						if ((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-						length += readBitsFromStream(bp, in, numextrabits);
-						unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if (error) return;
-						if (codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-						unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-						if ((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-						dist += readBitsFromStream(bp, in, numextrabitsD);
-						size_t start = pos, back = start - dist; //backwards
-						if (pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-						for (size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if (back >= start) back = start - dist; }
+						if (pos + length > out.size()) out.resize((pos + length) * 2); //reserve more room
+						for (size_t i = 0; i < length; i++) out[pos + i] = out[pos + i - dist];
 					}
+					pos += length;
 				}
+				if (br.exhausted()) error = 10; //error: end reached without endcode
 			}
-			void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
+			void inflateNoCompression(std::vector<unsigned char>& out, BitReader& br, size_t& pos)
 			{
-				while ((bp & 0x7) != 0) bp++; //go to first boundary of byte
-				size_t p = bp / 8;
-				if (p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
+				br.consume(br.count & 7); //go to first boundary of byte
+				size_t p = br.bytePos();
+				if (p + 4 > br.size) { error = 52; return; } //error, bit pointer will jump past memory
+				const unsigned char* in = br.in;
 				unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
 				if (LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
+				if (p + LEN > br.size) { error = 23; return; } //error: reading outside of in buffer
 				if (pos + LEN >= out.size()) out.resize(pos + LEN);
-				if (p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-				for (unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-				bp = p * 8;
+				if (LEN) memcpy(&out[pos], in + p, LEN); //read LEN bytes of literal data
+				pos += LEN;
+				br.seek(p + LEN);
 			}
 		};
 		int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
@@ -304,6 +330,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 			if (info.interlaceMethod == 0) //no interlace, just filter
 			{
 				size_t linestart = 0, linelength = (info.width * bpp + 7) / 8; //length in bytes of a scanline, excluding the filtertype byte
+				if (scanlines.size() < (1 + linelength) * info.height) { error = 91; return; } //error: the decompressed data is too small
 				if (bpp >= 8) //byte per byte
 					for (unsigned long y = 0; y < info.height; y++)
 					{
@@ -314,13 +341,14 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 					}
 				else //less than 8 bits per pixel, so fill it up bit per bit
 				{
-					std::vector<unsigned char> templine((info.width * bpp + 7) >> 3); //only used if bpp < 8
+					std::vector<unsigned char> templine(linelength), prevtempline(linelength); //only used if bpp < 8, the rows are unfiltered unpacked
 					for (size_t y = 0, obp = 0; y < info.height; y++)
 					{
 						unsigned long filterType = scanlines[linestart];
-						const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
+						const unsigned char* prevline = (y == 0) ? 0 : &prevtempline[0];
 						unFilterScanline(&templine[0], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if (error) return;
 						for (size_t bp = 0; bp < info.width * bpp;) setBitOfReversedStream(obp, out_, readBitFromReversedStream(bp, &templine[0]));
+						templine.swap(prevtempline);
 						linestart += (1 + linelength); //go to start of next scanline
 					}
 				}
@@ -332,6 +360,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 				size_t passstart[7] = { 0 };
 				size_t pattern[28] = { 0, 4, 0, 2, 0, 1, 0, 0, 0, 4, 0, 2, 0, 1, 8, 8, 4, 4, 2, 2, 1, 8, 8, 8, 4, 4, 2, 2 }; //values for the adam7 passes
 				for (int i = 0; i < 6; i++) passstart[i + 1] = passstart[i] + passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
+				if (scanlines.size() < passstart[6] + passh[6] * ((passw[6] ? 1 : 0) + (passw[6] * bpp + 7) / 8)) { error = 91; return; } //error: the decompressed data is too small
 				std::vector<unsigned char> scanlineo((info.width * bpp + 7) / 8), scanlinen((info.width * bpp + 7) / 8); //"old" and "new" scanline
 				for (int i = 0; i < 7; i++)
 					adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0], &scanlines[passstart[i]], info.width, pattern[i], pattern[i + 7], pattern[i + 14], pattern[i + 21], passw[i], passh[i], bpp);
@@ -356,20 +385,34 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 		}
 		void unFilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
 		{
+			size_t i = 0;
 			switch (filterType)
 			{
-			case 0: for (size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
+			case 0: memcpy(recon, scanline, length); break;
 			case 1:
-				for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
-				for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
+#ifdef PNG_SSE2
+				if (bytewidth == 4) i = unFilterSub4(recon, scanline, length);
+#endif
+				for (; i < bytewidth && i < length; i++) recon[i] = scanline[i];
+				for (; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
 				break;
 			case 2:
-				if (precon) for (size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
-				else       for (size_t i = 0; i < length; i++) recon[i] = scanline[i];
+				if (precon)
+				{
+#ifdef PNG_SSE2
+					for (; i + 16 <= length; i += 16)
+						_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(scanline + i)), _mm_loadu_si128((const __m128i*)(precon + i))));
+#endif
+					for (; i < length; i++) recon[i] = scanline[i] + precon[i];
+				}
+				else memcpy(recon, scanline, length);
 				break;
 			case 3:
 				if (precon)
 				{
+#ifdef PNG_SSE2
+					if (bytewidth == 3 || bytewidth == 4) { unFilterAverage(recon, scanline, precon, bytewidth, length); break; }
+#endif
 					for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
 					for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
 				}
@@ -382,6 +425,9 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 			case 4:
 				if (precon)
 				{
+#ifdef PNG_SSE2
+					if (bytewidth == 3 || bytewidth == 4) { unFilterPaeth(recon, scanline, precon, bytewidth, length); break; }
+#endif
 					for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
 					for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
 				}
@@ -394,6 +440,61 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 			default: error = 36; return; //error: unexisting filter type given
 			}
 		}
+#ifdef PNG_SSE2
+		//SSE2 unfiltering of the 8 bit RGB and RGBA scanlines. Sub adds up 4 pixels at once, Average and Paeth depend on the
+		//pixel on the left and go one pixel at a time, all its channels at once.
+		static __m128i loadPixel(const unsigned char* p, size_t bytewidth) { int v = 0; memcpy(&v, p, bytewidth); return _mm_cvtsi32_si128(v); }
+		static void storePixel(unsigned char* p, __m128i v, size_t bytewidth) { int x = _mm_cvtsi128_si32(v); memcpy(p, &x, bytewidth); }
+		static size_t unFilterSub4(unsigned char* recon, const unsigned char* scanline, size_t length) //returns the bytes done
+		{
+			__m128i left = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= length; i += 16)
+			{
+				__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i)); //prefix sum of the 4 pixels, plus the pixel on the left
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+				x = _mm_add_epi8(x, left);
+				_mm_storeu_si128((__m128i*)(recon + i), x);
+				left = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+			}
+			return i;
+		}
+		static void unFilterAverage(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, size_t length)
+		{
+			const __m128i one = _mm_set1_epi8(1);
+			__m128i a = _mm_setzero_si128();
+			for (size_t i = 0; i + bytewidth <= length; i += bytewidth)
+			{
+				__m128i b = loadPixel(precon + i, bytewidth);
+				__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)); //(a + b) / 2 rounded down
+				a = _mm_add_epi8(loadPixel(scanline + i, bytewidth), average);
+				storePixel(recon + i, a, bytewidth);
+			}
+		}
+		static void unFilterPaeth(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, size_t length)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i a = zero, c = zero; //16 bit channels of the pixels on the left and up left
+			for (size_t i = 0; i + bytewidth <= length; i += bytewidth)
+			{
+				__m128i b = _mm_unpacklo_epi8(loadPixel(precon + i, bytewidth), zero);
+				__m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c); //p - a, p - b with p = a + b - c
+				__m128i pc = _mm_add_epi16(pa, pb);
+				pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+				pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+				pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+				__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+				__m128i useB = _mm_cmpeq_epi16(pb, smallest), useA = _mm_cmpeq_epi16(pa, smallest); //a first, then b, then c on ties
+				__m128i predictor = _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(useB, c));
+				predictor = _mm_or_si128(_mm_and_si128(useA, a), _mm_andnot_si128(useA, predictor));
+				__m128i x = _mm_add_epi8(loadPixel(scanline + i, bytewidth), _mm_packus_epi16(predictor, zero));
+				storePixel(recon + i, x, bytewidth);
+				a = _mm_unpacklo_epi8(x, zero);
+				c = b;
+			}
+		}
+#endif
 		void adam7Pass(unsigned char* out, unsigned char* linen, unsigned char* lineo, const unsigned char* in, unsigned long w, size_t passleft, size_t passtop, size_t spacex, size_t spacey, size_t passw, size_t passh, unsigned long bpp)
 		{ //filter and reposition the pixels into the output when the image is Adam7 interlaced. This function can only do it after the full image is already decoded. The out buffer must have the correct allocated memory size already.
 			if (passw == 0) return;
@@ -401,7 +502,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 			for (unsigned long y = 0; y < passh; y++)
 			{
 				unsigned char filterType = in[y * linelength], *prevline = (y == 0) ? 0 : lineo;
-				unFilterScanline(linen, &in[y * linelength + 1], prevline, bytewidth, filterType, (w * bpp + 7) / 8); if (error) return;
+				unFilterScanline(linen, &in[y * linelength + 1], prevline, bytewidth, filterType, linelength - 1); if (error) return;
 				if (bpp >= 8) for (size_t i = 0; i < passw; i++) for (size_t b = 0; b < bytewidth; b++) //b = current byte of this pixel
 					out[bytewidth * w * (passtop + spacey * y) + bytewidth * (passleft + spacex * i) + b] = linen[bytewidth * i + b];
 				else for (size_t i = 0; i < passw; i++)
@@ -515,6 +616,8 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 	png.width = decoder.info.width;
 	png.height = decoder.info.height;
 
+	if (decoder.error) return decoder.error;
+
 	// premultiply by alpha
 	for (size_t i = 0; i < png.pixels.size(); i += 4) {
 		if (!png.pixels[i + 3]) {
@@ -529,31 +632,222 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
 
 int PNGParser::load(const char* filename, PNG& png) {
 
-	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+	// decode straight from the mapped file
+	MappedFile file(filename);
+	if (!file.isOpen() || file.size() == 0)
+		return -1;
 
-	// get filesize
-	std::streamsize size = 0;
-	if (file.seekg(0, std::ios::end).good()) 
-		size = file.tellg();
-	if (file.seekg(0, std::ios::beg).good()) 
-		size -= file.tellg();
+	// parse to png
+	return load(file.data(), file.size(), png);
 
-	// read contents of the file into the vector
-	std::vector<unsigned char> buffer;
-	if (size > 0) {
-		buffer.resize((size_t)size);
-		file.read((char*)(&buffer[0]), size);
+}
+
+//Encoder. The rows are cut in bands filtered and deflated independently, each band ending on a sync flush, so
+//their deflate streams concatenate into one zlib stream and each goes to its own IDAT chunk.
+
+//Bytes of filtered rows per band
+static const size_t kSaveBandBytes = 1 << 18;
+
+static unsigned char paethPredict(int a, int b, int c)
+{
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
+}
+
+/* Sum of the bytes taken as signed, the usual estimate of how well a filtered row compresses*/
+static uint64_t residualCost(const unsigned char* residuals, size_t size)
+{
+	uint64_t cost = 0;
+	size_t i = 0;
+#ifdef PNG_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	for (; i + 16 <= size; i += 16)
+	{
+		//|r| of a signed byte is min(r, -r) of the unsigned ones
+		__m128i r = _mm_loadu_si128((const __m128i*)(residuals + i));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_min_epu8(r, _mm_sub_epi8(zero, r)), zero));
 	}
-	else {
-		return -1;
+	cost = (uint64_t)_mm_cvtsi128_si32(sum) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#endif
+	for (; i < size; ++i) cost += abs((signed char)residuals[i]);
+	return cost;
+}
+
+/*
+* Filter a row of RGBA pixels with the filter type of the smallest residualCost. prev is the previous row, zeros
+* for the first one. dst receives the filter type and the filtered bytes, scratch is 4 * rowBytes bytes.
+*/
+static void filterRow(const unsigned char* row, const unsigned char* prev, size_t rowBytes, unsigned char* dst, unsigned char* scratch)
+{
+	unsigned char *sub = scratch, *up = sub + rowBytes, *average = up + rowBytes, *paeth = average + rowBytes;
+
+	//The first pixel has no left neighbor
+	size_t i = 0;
+	for (; i < 4 && i < rowBytes; ++i)
+	{
+		sub[i] = row[i];
+		up[i] = row[i] - prev[i];
+		average[i] = row[i] - (prev[i] >> 1);
+		paeth[i] = row[i] - prev[i];
 	}
+#ifdef PNG_SSE2
+	const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1), one16 = _mm_set1_epi16(1);
+	for (; i + 16 <= rowBytes; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i)), a = _mm_loadu_si128((const __m128i*)(row + i - 4));
+		__m128i b = _mm_loadu_si128((const __m128i*)(prev + i)), c = _mm_loadu_si128((const __m128i*)(prev + i - 4));
 
-	// parse to png
-	return load(&buffer[0], size, png);
+		//Paeth in 16 bit lanes, p - a = b - c, p - b = a - c, p - c = (b - c) + (a - c)
+		__m128i predictor[2];
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128i a16 = half ? _mm_unpackhi_epi8(a, zero) : _mm_unpacklo_epi8(a, zero);
+			__m128i b16 = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+			__m128i c16 = half ? _mm_unpackhi_epi8(c, zero) : _mm_unpacklo_epi8(c, zero);
+			__m128i pa = _mm_sub_epi16(b16, c16), pb = _mm_sub_epi16(a16, c16);
+			__m128i pc = _mm_add_epi16(pa, pb);
+			pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+			pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+			pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+			__m128i useA = _mm_and_si128(_mm_cmpgt_epi16(_mm_add_epi16(pb, one16), pa), _mm_cmpgt_epi16(_mm_add_epi16(pc, one16), pa));
+			__m128i useB = _mm_cmpgt_epi16(_mm_add_epi16(pc, one16), pb);
+			__m128i p = _mm_or_si128(_mm_and_si128(useB, b16), _mm_andnot_si128(useB, c16));
+			predictor[half] = _mm_or_si128(_mm_and_si128(useA, a16), _mm_andnot_si128(useA, p));
+		}
 
+		//floor((a + b) / 2) from the rounding up average
+		__m128i floorAverage = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		_mm_storeu_si128((__m128i*)(sub + i), _mm_sub_epi8(x, a));
+		_mm_storeu_si128((__m128i*)(up + i), _mm_sub_epi8(x, b));
+		_mm_storeu_si128((__m128i*)(average + i), _mm_sub_epi8(x, floorAverage));
+		_mm_storeu_si128((__m128i*)(paeth + i), _mm_sub_epi8(x, _mm_packus_epi16(predictor[0], predictor[1])));
+	}
+#endif
+	for (; i < rowBytes; ++i)
+	{
+		sub[i] = row[i] - row[i - 4];
+		up[i] = row[i] - prev[i];
+		average[i] = row[i] - ((row[i - 4] + prev[i]) >> 1);
+		paeth[i] = row[i] - paethPredict(row[i - 4], prev[i], prev[i - 4]);
+	}
+
+	const unsigned char* filtered[5] = { row, sub, up, average, paeth };
+	int best = 0;
+	uint64_t bestCost = residualCost(row, rowBytes);
+	for (int type = 1; type < 5; ++type)
+	{
+		uint64_t cost = residualCost(filtered[type], rowBytes);
+		if (cost < bestCost) { bestCost = cost; best = type; }
+	}
+	dst[0] = (unsigned char)best;
+	memcpy(dst + 1, filtered[best], rowBytes);
+}
+
+static void putBigEndian(std::vector<unsigned char>& out, uint32_t value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+/* Length and type of a chunk, its data is appended after*/
+static size_t beginChunk(std::vector<unsigned char>& out, const char* type)
+{
+	size_t start = out.size();
+	putBigEndian(out, 0);
+	out.insert(out.end(), type, type + 4);
+	return start;
 }
 
-int PNGParser::save(const char *filename, const PNG& png) {
-	return 0;
+/* Patch the length of the chunk begun at start and append its CRC*/
+static void endChunk(std::vector<unsigned char>& out, size_t start)
+{
+	uint32_t length = (uint32_t)(out.size() - start - 8);
+	for (int k = 0; k < 4; ++k) out[start + k] = (unsigned char)(length >> (24 - 8 * k));
+	putBigEndian(out, crc32(0, &out[start + 4], length + 4));
+}
+
+int PNGParser::save(const char* filename, const unsigned char* pixels, int width, int height, Compression compression)
+{
+	if (!filename || !pixels || width <= 0 || height <= 0) return -1;
+
+	static const int kLevels[] = { 0, 1, 6 };
+	const int level = kLevels[compression];
+	const size_t rowBytes = 4 * (size_t)width;
+	const size_t rowsPerBand = std::max((size_t)1, kSaveBandBytes / (rowBytes + 1));
+	const size_t bands = (height + rowsPerBand - 1) / rowsPerBand;
+
+	std::vector<std::vector<unsigned char> > chunks(bands);
+	std::vector<uint32_t> adlers(bands);
+	ThreadPool::instance().parallelFor(bands, 1, [&](size_t begin, size_t end)
+	{
+		std::vector<unsigned char> filtered, scratch(4 * rowBytes), zeros(rowBytes, 0);
+		for (size_t band = begin; band < end; ++band)
+		{
+			size_t first = band * rowsPerBand, last = std::min(first + rowsPerBand, (size_t)height);
+			filtered.resize((last - first) * (rowBytes + 1));
+			for (size_t y = first; y < last; ++y)
+			{
+				const unsigned char* row = pixels + y * rowBytes;
+				unsigned char* dst = &filtered[(y - first) * (rowBytes + 1)];
+				if (level == 0)
+				{
+					//no filter, the data is stored anyway
+					dst[0] = 0;
+					memcpy(dst + 1, row, rowBytes);
+				}
+				else filterRow(row, y ? row - rowBytes : &zeros[0], rowBytes, dst, &scratch[0]);
+			}
+			adlers[band] = adler32(1, &filtered[0], filtered.size());
+
+			std::vector<unsigned char>& chunk = chunks[band];
+			size_t start = beginChunk(chunk, "IDAT");
+			if (band == 0)
+			{
+				//zlib header, 32K window, the level hint of zlib
+				chunk.push_back(0x78);
+				chunk.push_back(level >= 6 ? 0x9C : 0x01);
+			}
+			deflateSync(&filtered[0], filtered.size(), level, chunk);
+			endChunk(chunk, start);
+		}
+	});
+
+	uint32_t adler = adlers[0];
+	for (size_t band = 1; band < bands; ++band)
+	{
+		size_t rows = std::min(rowsPerBand, height - band * rowsPerBand);
+		adler = adler32Combine(adler, adlers[band], rows * (rowBytes + 1));
+	}
+
+	static const unsigned char kSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	std::vector<unsigned char> head(kSignature, kSignature + 8), tail;
+	size_t start = beginChunk(head, "IHDR");
+	putBigEndian(head, (uint32_t)width);
+	putBigEndian(head, (uint32_t)height);
+	const unsigned char kFormat[5] = { 8, 6, 0, 0, 0 }; //8 bit RGBA, deflate, adaptive filtering, not interlaced
+	head.insert(head.end(), kFormat, kFormat + 5);
+	endChunk(head, start);
+
+	start = beginChunk(tail, "IDAT");
+	tail.insert(tail.end(), kDeflateFinalBlock, kDeflateFinalBlock + 2);
+	putBigEndian(tail, adler);
+	endChunk(tail, start);
+	endChunk(tail, beginChunk(tail, "IEND"));
+
+	std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file) return -1;
+	file.write((const char*)&head[0], head.size());
+	for (size_t band = 0; band < bands; ++band) file.write((const char*)&chunks[band][0], chunks[band].size());
+	file.write((const char*)&tail[0], tail.size());
+	return file.good() ? 0 : -1;
+}
+
+int PNGParser::save(const char* filename, const PNG& png, Compression compression)
+{
+	if (png.width <= 0 || png.height <= 0 || png.pixels.size() < 4 * (size_t)png.width * png.height) return -1;
+	return save(filename, &png.pixels[0], png.width, png.height, compression);
 }
 }
\ No newline at end of file
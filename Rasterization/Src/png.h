@@ -14,9 +14,24 @@ struct PNG {
 
 class PNGParser {
 public:
+	/* Speed against size of save. STORE writes the pixels uncompressed, FAST compresses about like zlib level 1*/
+	enum Compression
+	{
+		COMPRESSION_STORE = 0,
+		COMPRESSION_FAST,
+		COMPRESSION_DEFAULT,
+	};
+
 	static int load(const unsigned char* buffer, size_t size, PNG& png);
 	static int load(const char* filename, PNG& png);
-	static int save(const char* filename, const PNG& png);
+
+	/*
+	* Write width * height RGBA pixels, 4 * width bytes per row, as an 8 bit RGBA png. Returns 0 on success.
+	* Bands of rows are filtered and deflated in parallel, each into its own IDAT chunk.
+	*/
+	static int save(const char* filename, const unsigned char* pixels, int width, int height,
+					Compression compression = COMPRESSION_DEFAULT);
+	static int save(const char* filename, const PNG& png, Compression compression = COMPRESSION_DEFAULT);
 }; // class PNGParser
 
 
@@ -0,0 +1,163 @@
+#include "scene.h"
+#include "triangular.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace CGCore
+{
+
+/* FNV-1a of the bytes of a style, Style has no padding*/
+static uint32_t hashStyle(const Style& style)
+{
+	const unsigned char* p = (const unsigned char*)&style;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < sizeof(Style); ++i) hash = (hash ^ p[i]) * 16777619u;
+	return hash;
+}
+
+static const uint32_t kNoStyle = 0xFFFFFFFF;
+
+/*
+* Styles are shared by value, the documents usually repeat a few of them. The table holds indices in
+* Scene::styles, linearly probed, and has at least twice as many slots as there are items so it never fills.
+*/
+struct Scene::Builder
+{
+	explicit Builder(size_t itemCount)
+	{
+		size_t size = 16;
+		while (size < 2 * itemCount) size *= 2;
+		slots.assign(size, kNoStyle);
+	}
+
+	vector<uint32_t> slots;
+};
+
+/* Items and triangle indices of the drawn elements under element, to size the tables up front*/
+static void countItems(const SVGElement* element, size_t& items, size_t& indices)
+{
+	switch (element->type)
+	{
+	case GROUP:
+		for (const SVGElement* child : static_cast<const Group&>(*element).elements) countItems(child, items, indices);
+		return;
+	case POLYGON:
+		if (element->count >= 3) indices += 3 * (element->count - 2);
+		break;
+	case POINT:
+	case LINE:
+	case RECT:
+	case POLYLINE:
+	case IMAGE:
+		break;
+	default:
+		return;
+	}
+	++items;
+}
+
+static bool isIdentity(const Matrix3x3& m)
+{
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			if (m(i, j) != (i == j ? 1. : 0.)) return false;
+	return true;
+}
+
+void Scene::clear()
+{
+	x = NULL;
+	y = NULL;
+	indices.clear();
+	items.clear();
+	styles.clear();
+	transforms.clear();
+	textures.clear();
+}
+
+void Scene::build(const SVG& svg)
+{
+	clear();
+
+	x = svg.x.data();
+	y = svg.y.data();
+
+	size_t itemCount = 0, indexCount = 0;
+	for (const SVGElement* element : svg.elements) countItems(element, itemCount, indexCount);
+	items.reserve(itemCount);
+	indices.reserve(indexCount);
+
+	//The top level elements are drawn with the view transform alone
+	transforms.push_back(Matrix3x3::identity());
+	Builder builder(itemCount);
+	for (const SVGElement* element : svg.elements) add(builder, element, 0);
+}
+
+void Scene::add(Builder& builder, const SVGElement* element, uint32_t parentTransform)
+{
+	//An identity transform, the usual case, shares the entry of its parent
+	uint32_t transform = parentTransform;
+	if (!isIdentity(element->transform))
+	{
+		transform = (uint32_t)transforms.size();
+		transforms.push_back(transforms[parentTransform] * element->transform);
+	}
+
+	if (element->type == GROUP)
+	{
+		const Group& group = static_cast<const Group&>(*element);
+		for (const SVGElement* child : group.elements) add(builder, child, transform);
+		return;
+	}
+
+	Item item;
+	item.type = element->type;
+	item.first = element->first;
+	item.count = element->count;
+	item.transform = transform;
+	item.texture = 0;
+	item.indexCount = 0;
+	switch (element->type)
+	{
+	case POINT:
+	case LINE:
+	case RECT:
+	case POLYGON:
+	case POLYLINE:
+		break;
+	case IMAGE:
+		item.texture = (uint32_t)textures.size();
+		textures.push_back(static_cast<const Image&>(*element).tex.get());
+		break;
+	default:
+		//not drawn
+		return;
+	}
+
+	//The fill of a polygon is triangulated once, in document space, a frame only transforms the vertices
+	if (item.type == POLYGON && item.count >= 3)
+	{
+		item.firstIndex = (uint32_t)indices.size();
+		triangulate(&x[item.first], &y[item.first], (int)item.count, indices);
+		item.indexCount = (uint32_t)indices.size() - item.firstIndex;
+	}
+
+	size_t mask = builder.slots.size() - 1;
+	size_t slot = hashStyle(element->style) & mask;
+	while (builder.slots[slot] != kNoStyle && memcmp(&styles[builder.slots[slot]], &element->style, sizeof(Style)) != 0)
+	{
+		slot = (slot + 1) & mask;
+	}
+	if (builder.slots[slot] == kNoStyle)
+	{
+		builder.slots[slot] = (uint32_t)styles.size();
+		styles.push_back(element->style);
+	}
+	item.style = builder.slots[slot];
+
+	items.push_back(item);
+}
+
+}
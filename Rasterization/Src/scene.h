@@ -0,0 +1,60 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "svg.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace CGCore
+{
+
+/*
+* The drawable content of an SVG laid out flat for the renderer, built once per document. The groups are
+* resolved at build time: each item holds the transform of its element composed with those of its groups,
+* in document space, so a frame walks the items front to back without recursion. The coordinates of the
+* items are read in place from the pools x and y of the document, filled by the parser, and the styles and
+* transforms are in tables shared by the items, so that the per item record stays small and a frame reads
+* memory linearly. The polygons are triangulated at build time too, their triangles are kept as vertex
+* indices in the pool indices.
+*/
+struct Scene
+{
+	struct Item
+	{
+		SVGELementType type;
+		uint32_t	   first;	  //coordinates [first, first + count) of the pools, as in SVGElement
+		uint32_t	   count;
+		uint32_t	   style;	  //in styles
+		uint32_t	   transform; //in transforms
+		union
+		{
+			uint32_t   texture;	  //in textures, for an image
+			uint32_t   firstIndex; //indices [firstIndex, firstIndex + indexCount) of the fill, for a polygon
+		};
+		uint32_t	   indexCount; //0 but for the polygons, whose indices count their vertices from first
+	};
+
+	Scene() : x(NULL), y(NULL) {}
+
+	/* Replace the content with the elements of svg. The coordinates and the textures stay owned by svg.*/
+	void build(const SVG& svg);
+
+	void clear();
+
+	const float*				x;		  //the pools of the document
+	const float*				y;
+	std::vector<uint32_t>		indices;
+	std::vector<Item>			items;
+	std::vector<Style>			styles;
+	std::vector<Matrix3x3>		transforms;
+	std::vector<const Texture*>	textures; //NULL for the images that couldn't be read
+
+private:
+	struct Builder;
+	void add(Builder& builder, const SVGElement* element, uint32_t parentTransform);
+}; // struct Scene
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+#include "snapshot.h"
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace CGCore
+{
+
+/* Fixed buffer in front of a file descriptor, written out each time it fills*/
+class SnapshotStream
+{
+public:
+	enum { kCapacity = 1 << 16 };
+
+	explicit SnapshotStream(int fd) : m_fd(fd), m_size(0), m_failed(false), m_buffer(kCapacity) {}
+
+	/* Room for count bytes, count <= kCapacity. The bytes used are then given to commit.*/
+	unsigned char* reserve(size_t count)
+	{
+		if (m_size + count > kCapacity) flush();
+		return &m_buffer[m_size];
+	}
+
+	void commit(size_t count) { m_size += count; }
+
+	size_t room() const { return kCapacity - m_size; }
+
+	void put(const void* data, size_t size)
+	{
+		if (size > room())
+		{
+			//large spans skip the buffer
+			flush();
+			writeAll((const unsigned char*)data, size);
+			return;
+		}
+		memcpy(&m_buffer[m_size], data, size);
+		m_size += size;
+	}
+
+	void flush()
+	{
+		writeAll(&m_buffer[0], m_size);
+		m_size = 0;
+	}
+
+	bool failed() const { return m_failed; }
+
+private:
+	void writeAll(const unsigned char* data, size_t size)
+	{
+		while (size > 0 && !m_failed)
+		{
+			unsigned int count = (unsigned int)min(size, (size_t)INT_MAX);
+#ifdef _WIN32
+			int written = _write(m_fd, data, count);
+#else
+			int written = (int)::write(m_fd, data, count);
+#endif
+			if (written <= 0) { m_failed = true; return; }
+			data += written;
+			size -= written;
+		}
+	}
+
+	int						m_fd;
+	size_t					m_size;
+	bool					m_failed;
+	vector<unsigned char>	m_buffer;
+};
+
+static void putBigEndian(unsigned char* p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+/*
+* QOI, as specified at qoiformat.org. Each pixel is a run of the previous one, an index in the table of
+* the 64 recently seen pixels, a small difference to the previous one, or the pixel itself.
+*/
+enum
+{
+	QOI_OP_INDEX = 0x00,
+	QOI_OP_DIFF	 = 0x40,
+	QOI_OP_LUMA	 = 0x80,
+	QOI_OP_RUN	 = 0xC0,
+	QOI_OP_RGB	 = 0xFE,
+	QOI_OP_RGBA	 = 0xFF,
+	QOI_MAX_RUN	 = 62,
+};
+
+static void writeQOI(SnapshotStream& stream, const unsigned char* pixels, int width, int height)
+{
+	unsigned char header[14] = { 'q', 'o', 'i', 'f' };
+	putBigEndian(header + 4, (uint32_t)width);
+	putBigEndian(header + 8, (uint32_t)height);
+	header[12] = 4; //RGBA
+	header[13] = 0; //sRGB with linear alpha
+	stream.put(header, sizeof(header));
+
+	uint32_t seen[64] = { 0 };
+	unsigned char prev[4] = { 0, 0, 0, 255 };
+	uint32_t prevValue;
+	memcpy(&prevValue, prev, 4);
+	int run = 0;
+
+	const unsigned char* px = pixels;
+	const unsigned char* end = pixels + 4 * (size_t)width * height;
+	for (; px != end; px += 4)
+	{
+		uint32_t value;
+		memcpy(&value, px, 4);
+		if (value == prevValue)
+		{
+			if (++run == QOI_MAX_RUN)
+			{
+				*stream.reserve(1) = (unsigned char)(QOI_OP_RUN | (run - 1));
+				stream.commit(1);
+				run = 0;
+			}
+			continue;
+		}
+
+		//at most a run and an RGBA op
+		unsigned char* out = stream.reserve(6);
+		unsigned char* op = out;
+		if (run > 0)
+		{
+			*op++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+			run = 0;
+		}
+
+		int index = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63;
+		if (seen[index] == value)
+		{
+			*op++ = (unsigned char)(QOI_OP_INDEX | index);
+		}
+		else
+		{
+			seen[index] = value;
+			if (px[3] == prev[3])
+			{
+				signed char dr = (signed char)(px[0] - prev[0]);
+				signed char dg = (signed char)(px[1] - prev[1]);
+				signed char db = (signed char)(px[2] - prev[2]);
+				signed char drg = (signed char)(dr - dg);
+				signed char dbg = (signed char)(db - dg);
+				if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+				{
+					*op++ = (unsigned char)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+				}
+				else if (drg > -9 && drg < 8 && dg > -33 && dg < 32 && dbg > -9 && dbg < 8)
+				{
+					*op++ = (unsigned char)(QOI_OP_LUMA | (dg + 32));
+					*op++ = (unsigned char)((drg + 8) << 4 | (dbg + 8));
+				}
+				else
+				{
+					*op++ = QOI_OP_RGB;
+					*op++ = px[0]; *op++ = px[1]; *op++ = px[2];
+				}
+			}
+			else
+			{
+				*op++ = QOI_OP_RGBA;
+				*op++ = px[0]; *op++ = px[1]; *op++ = px[2]; *op++ = px[3];
+			}
+		}
+		stream.commit(op - out);
+		memcpy(prev, px, 4);
+		prevValue = value;
+	}
+	if (run > 0)
+	{
+		*stream.reserve(1) = (unsigned char)(QOI_OP_RUN | (run - 1));
+		stream.commit(1);
+	}
+
+	static const unsigned char kEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	stream.put(kEnd, sizeof(kEnd));
+}
+
+static void writePPM(SnapshotStream& stream, const unsigned char* pixels, int width, int height)
+{
+	char header[64];
+	int length = sprintf(header, "P6\n%d %d\n255\n", width, height);
+	stream.put(header, length);
+
+	//RGBA to RGB, as many pixels as the buffer has room for at a time
+	const unsigned char* px = pixels;
+	size_t left = (size_t)width * height;
+	while (left > 0)
+	{
+		size_t count = min(left, stream.room() / 3);
+		if (count == 0)
+		{
+			stream.flush();
+			continue;
+		}
+		unsigned char* out = stream.reserve(3 * count);
+		for (size_t i = 0; i < count; ++i, px += 4, out += 3)
+		{
+			out[0] = px[0]; out[1] = px[1]; out[2] = px[2];
+		}
+		stream.commit(3 * count);
+		left -= count;
+	}
+}
+
+int SnapshotWriter::write(int fd, const unsigned char* pixels, int width, int height, Format format)
+{
+	if (fd < 0 || !pixels || width <= 0 || height <= 0) return -1;
+
+	SnapshotStream stream(fd);
+	switch (format)
+	{
+	case FORMAT_QOI: writeQOI(stream, pixels, width, height); break;
+	case FORMAT_RAW: stream.put(pixels, 4 * (size_t)width * height); break;
+	case FORMAT_PPM: writePPM(stream, pixels, width, height); break;
+	default: return -1;
+	}
+	stream.flush();
+	return stream.failed() ? -1 : 0;
+}
+
+int SnapshotWriter::save(const char* filename, const unsigned char* pixels, int width, int height, Format format)
+{
+	if (!filename) return -1;
+#ifdef _WIN32
+	int fd = _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+	if (fd < 0) return -1;
+
+	int error = write(fd, pixels, width, height, format);
+#ifdef _WIN32
+	if (_close(fd) != 0) error = -1;
+#else
+	if (close(fd) != 0) error = -1;
+#endif
+	return error;
+}
+
+const char* SnapshotWriter::extension(Format format)
+{
+	switch (format)
+	{
+	case FORMAT_QOI: return "qoi";
+	case FORMAT_RAW: return "rgba";
+	case FORMAT_PPM: return "ppm";
+	default:		 return "";
+	}
+}
+
+}
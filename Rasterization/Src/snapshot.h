@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+
+namespace CGCore
+{
+
+/*
+* Uncompressed or lightly compressed frame dumps, for the jobs writing many frames where png is too slow.
+* The pixels are encoded row by row through a fixed buffer and written to a file descriptor as it fills,
+* so no copy of the image is made and a pipe can be written to as well as a file.
+*/
+class SnapshotWriter
+{
+public:
+	enum Format
+	{
+		FORMAT_QOI = 0, //"Quite OK Image" format, lossless RGBA, the size of a fast png in a fraction of the time
+		FORMAT_RAW,		//the RGBA bytes, no header
+		FORMAT_PPM,		//binary P6 ppm, the alpha is dropped
+	};
+
+	/* Write width * height RGBA pixels, 4 * width bytes per row, to an open file descriptor. Returns 0 on success.*/
+	static int write(int fd, const unsigned char* pixels, int width, int height, Format format);
+
+	/* Create or truncate filename and write the pixels to it*/
+	static int save(const char* filename, const unsigned char* pixels, int width, int height, Format format);
+
+	/* The usual extension of the format, without the dot*/
+	static const char* extension(Format format);
+}; // class SnapshotWriter
+
+}
+
+#endif
@@ -10,6 +10,11 @@
 #include <algorithm>
 #include <cmath>
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define RENDERER_SSE2
+#include <emmintrin.h>
+#endif
+
 #include <GLFW\glfw3.h>
 
 using namespace std;
@@ -22,6 +27,8 @@ namespace CGCore
 void	SoftwareRenderer::setSVG(const SVG* svg)
 {
 	m_svg = svg;
+	m_scene.build(*svg);
+	m_strokeCache.clear();
 	float cx = m_svg->width / 2.f;
 	float cy = m_svg->height / 2.f;
 	float span = 1.2 * max(m_svg->width, m_svg->height) / 2.f;
@@ -48,6 +55,10 @@ void SoftwareRenderer::resize(size_t w, size_t h)
 	m_width = w; m_height = h;
 	m_framebuffer.clear();
 	m_framebuffer.resize(4 * w * h, 255);
+	m_mlaa.resize(w, h);
+	m_fxaa.resize(w, h);
+	m_spanScratch.resize(4 * w);
+	m_imageSpan.resize(4 * w);
 
 	drawSVG();
 }
@@ -119,26 +130,192 @@ void SoftwareRenderer::rasterizeMLAA_case1()
 	rasterizePoint(m_width - 1, m_height - 1, Color::Black);
 }
 
+/*
+* For testing of the line clipping: random lines entering the viewport through its left or top border.
+* About one in twenty of their clipped end points rounds a hair outside the viewport, these must still land
+* on the border pixels and not before the framebuffer. Run it with a memory checker.
+*/
+void SoftwareRenderer::rasterizeClipping_case1()
+{
+	uint32_t seed = 12345;
+	for (int i = 0; i < 4096; ++i)
+	{
+		float v[4];
+		for (int k = 0; k < 4; ++k)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			v[k] = (seed >> 8) / 16777216.f;
+		}
+		float x0 = (i & 1) ? -v[0] * m_width : v[0] * m_width;
+		float y0 = (i & 1) ? v[1] * m_height : -v[1] * m_height;
+		rasterizeLine(x0, y0, v[2] * m_width, v[3] * m_height, Color::Black);
+	}
+}
+
+/*
+* For testing of the translucent strokes: a wide polyline with a sharp turn, whose triangles overlap at the
+* join, and a thin closed one drawn with 1 pixel lines. Drawn in half transparent black over white, each of
+* their pixels must be blended once, to the same gray.
+*/
+bool SoftwareRenderer::drawStroke_case1()
+{
+	static const uint32_t kTestKey = 0xFFFFFFFF; //not a scene item
+
+	//the pixels are white or blended once, checked after each stroke
+	unsigned char gray = (unsigned char)(0.5f * 255.f);
+	auto blendedOnce = [&]() -> bool
+	{
+		bool once = true;
+		for (size_t i = 0; i < m_framebuffer.size(); i += 4)
+		{
+			if (m_framebuffer[i] != 255 && m_framebuffer[i] != gray) once = false;
+		}
+		memset(&m_framebuffer[0], 255, m_framebuffer.size());
+		return once;
+	};
+
+	memset(&m_framebuffer[0], 255, m_framebuffer.size());
+	AAMode aaMode = m_aaMode;
+	m_aaMode = AA_MLAA; //no Wu lines, whose pixels are partly covered
+
+	Style style;
+	style.strokeColor = Color(0.f, 0.f, 0.f, 0.5f);
+	style.strokeWidth = 0.05f * min(m_width, m_height);
+	style.miterLimit = 10.f;
+	float w = (float)m_width, h = (float)m_height;
+	float turnX[3] = { 0.1f * w, 0.5f * w, 0.3f * w };
+	float turnY[3] = { 0.1f * h, 0.9f * h, 0.15f * h };
+	drawStroke(style, kTestKey, turnX, turnY, 3, false, Matrix3x3::identity());
+	m_strokeCache.erase(kTestKey);
+	bool once = blendedOnce();
+
+	style.strokeWidth = 1.f;
+	float squareX[4] = { 0.6f * w, 0.9f * w, 0.9f * w, 0.6f * w };
+	float squareY[4] = { 0.2f * h, 0.2f * h, 0.5f * h, 0.5f * h };
+	drawStroke(style, kTestKey, squareX, squareY, 4, true, Matrix3x3::identity());
+	once = blendedOnce() && once;
+
+	m_aaMode = aaMode;
+	return once;
+}
+
+/*
+* For testing of the translucent images: a half transparent red texture drawn over the middle of the screen,
+* across the left half filled in opaque blue. Away from the borders, the pixels must be the red blended once
+* over the blue or over the white, the others untouched.
+*/
+bool SoftwareRenderer::rasterizeImage_case1()
+{
+	static const unsigned char kTexel[4] = { 255, 0, 0, 128 };
+
+	MipLevel mip0;
+	mip0.width = mip0.height = 4;
+	mip0.texels.resize(4 * 4 * 4);
+	for (size_t i = 0; i < mip0.texels.size(); ++i) mip0.texels[i] = kTexel[i & 3];
+	Texture tex;
+	tex.generateMips(mip0);
+
+	memset(&m_framebuffer[0], 255, m_framebuffer.size());
+	float w = (float)m_width, h = (float)m_height;
+	Color blue(0.f, 0.f, 1.f, 1.f);
+	rasterizeTriangle(0.f, 0.f, 0.f, h, 0.5f * w, h, blue);
+	rasterizeTriangle(0.f, 0.f, 0.5f * w, 0.f, 0.5f * w, h, blue);
+
+	Matrix3x3 uvToScreen = Matrix3x3::identity();
+	uvToScreen(0, 0) = 0.5 * w; uvToScreen(0, 2) = 0.25 * w;
+	uvToScreen(1, 1) = 0.5 * h; uvToScreen(1, 2) = 0.25 * h;
+	rasterizeImage(uvToScreen, tex);
+
+	//1 pixel away from the borders, where the fill and the image may cover part of a pixel
+	auto inside = [](float c, float lo, float hi) { return c > lo + 1.f && c < hi - 1.f; };
+	auto outside = [](float c, float lo, float hi) { return c < lo - 1.f || c > hi + 1.f; };
+	float a = kTexel[3] / 255.f;
+	bool blended = true;
+	for (size_t y = 0; y < m_height; ++y)
+	{
+		for (size_t x = 0; x < m_width; ++x)
+		{
+			float cx = x + 0.5f, cy = y + 0.5f;
+			bool inFill = inside(cx, 0.f, 0.5f * w), outFill = outside(cx, 0.f, 0.5f * w);
+			bool inImage = inside(cx, 0.25f * w, 0.75f * w) && inside(cy, 0.25f * h, 0.75f * h);
+			bool outImage = outside(cx, 0.25f * w, 0.75f * w) || outside(cy, 0.25f * h, 0.75f * h);
+			if (!(inFill || outFill) || !(inImage || outImage)) continue;
+
+			const unsigned char *pixel = &m_framebuffer[4 * (x + y * m_width)];
+			float below[3] = { inFill ? 0.f : 255.f, inFill ? 0.f : 255.f, 255.f };
+			for (int c = 0; c < 3; ++c)
+			{
+				float expected = inImage ? kTexel[c] * a + below[c] * (1.f - a) : below[c];
+				if (fabs(pixel[c] - expected) > 1.f) blended = false;
+			}
+		}
+	}
+
+	memset(&m_framebuffer[0], 255, m_framebuffer.size());
+	return blended;
+}
+
+const char* SoftwareRenderer::aaModeName(AAMode mode)
+{
+	switch (mode)
+	{
+	case AA_NONE: return "no AA";
+	case AA_MLAA: return "MLAA";
+	case AA_FXAA: return "FXAA";
+	default:	  return "unknown AA";
+	}
+}
+
 /*
 * Draw the SVG to the framebuffer. We first initialize the m_SVGToScreen transformation matrix
-* m_SVGToScreen = NDCToScreen * SVGToNDC. then we draw svg's each element.
+* m_SVGToScreen = NDCToScreen * SVGToNDC. then we draw the items of the scene in document order.
 */
 void SoftwareRenderer::drawSVG()
 {
+	double drawBegin = glfwGetTime();
+
 	//SVGToNDC
 	Matrix3x3 SVGToNDC    = getSVGToNDC();
 	Matrix3x3 NDCToScreen = getNDCToScreen();
 
-	//Draw the SVG elements
-	for (const SVGElement* elemnt : m_svg->elements)
+	//The scene transforms to the screen, then the items in document order
+	Matrix3x3 SVGToScreen = NDCToScreen * SVGToNDC;
+	m_screenTransforms.resize(m_scene.transforms.size());
+	for (size_t i = 0; i < m_scene.transforms.size(); ++i)
+	{
+		m_screenTransforms[i] = SVGToScreen * m_scene.transforms[i];
+	}
+	for (uint32_t i = 0; i < (uint32_t)m_scene.items.size(); ++i)
 	{
-		drawSVGElement(elemnt, NDCToScreen * SVGToNDC);
+		drawItem(i, m_screenTransforms[m_scene.items[i].transform]);
 	}
 
 	//rasterizeMLAA_case1();
+	//rasterizeClipping_case1();
+	//drawStroke_case1();
+	//rasterizeImage_case1();
 	
-	MLAntialias mlaa(&m_framebuffer[0], m_width, m_height);
-	mlaa.resolve();
+	double aaBegin = glfwGetTime();
+	switch (m_aaMode)
+	{
+	case AA_MLAA:
+		m_mlaa.resolve(&m_framebuffer[0]);
+		break;
+	case AA_FXAA:
+		m_mlaa.clearMarks();
+		m_fxaa.resolve(&m_framebuffer[0]);
+		break;
+	default:
+		m_mlaa.clearMarks();
+		break;
+	}
+	double aaEnd = glfwGetTime();
+
+	if (m_reportTiming)
+	{
+		out_msg("frame " << (aaEnd - drawBegin) * 1000. << " ms (draw " << (aaBegin - drawBegin) * 1000. 
+			<< " ms, " << aaModeName(m_aaMode) << " " << (aaEnd - aaBegin) * 1000. << " ms)");
+	}
 
 	//Draw the canvas frame
 	/*
@@ -173,6 +350,13 @@ void SoftwareRenderer::rasterizePoint(float x, float y, Color color)
 	int ix = (int)floor(x); if (ix < 0 || ix >= m_width) return;
 	int iy = (int)floor(y); if (iy < 0 || iy >= m_height) return;
 
+	if (m_strokeStamp)
+	{
+		uint32_t& stamp = m_strokeStamps[ix + iy * m_width];
+		if (stamp == m_strokeStamp) return;
+		stamp = m_strokeStamp;
+	}
+
 	unsigned char *pixel = &m_framebuffer[0] + 4 * (ix + iy * m_width);
 
 	//Perform Alpha blending
@@ -185,131 +369,248 @@ void SoftwareRenderer::rasterizePoint(float x, float y, Color color)
 
 }
 
+/*
+* Clip the segment (x0, y0) (x1, y1) to the rectangle [xmin, xmax] x [ymin, ymax] with Liang-Barsky.
+* Returns false if the segment is entirely outside.
+*/
+static bool clipLine(float& x0, float& y0, float& x1, float& y1, float xmin, float ymin, float xmax, float ymax)
+{
+	float dx = x1 - x0, dy = y1 - y0;
+	float p[4] = { -dx, dx, -dy, dy };
+	float q[4] = { x0 - xmin, xmax - x0, y0 - ymin, ymax - y0 };
+	float t0 = 0.f, t1 = 1.f;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (p[i] == 0.f)
+		{
+			if (q[i] < 0.f) return false; //parallel to this boundary and outside
+			continue;
+		}
+		float t = q[i] / p[i];
+		if (p[i] < 0.f) { if (t > t1) return false; t0 = max(t0, t); } //entering
+		else			{ if (t < t0) return false; t1 = min(t1, t); } //leaving
+	}
+	if (!(t0 <= t1)) return false; //NaN
+
+	x1 = x0 + t1 * dx; y1 = y0 + t1 * dy;
+	x0 = x0 + t0 * dx; y0 = y0 + t0 * dy;
+	return true;
+}
+
 /*
 * Rasterize a line with color.
-* Use Bresenham (https://www.cs.helsinki.fi/group/goa/mallinnus/lines/bresenh.html) to rasterize the line
+* The line is first clipped to the viewport, so the work is bounded by the visible length.
+* Then we step between the pixels of the two end points with integer Bresenham 
+* (https://www.cs.helsinki.fi/group/goa/mallinnus/lines/bresenh.html)
 */
 void SoftwareRenderer::rasterizeLine(float x0, float y0, float x1, float y1, Color color, float width)
 {
-	x0 = floor(x0) + 0.5;
-	y0 = floor(y0) + 0.5;
-
-	float slope = (x0 == x1) ? (slope = 1.0f / FLT_MIN) : ((y1 - y0) / (x1 - x0));
-	float r; //Reference component
-	float c; //Complement component
-	float rend; //Reference componet end
-	float cdiff;
-	float cinc;
-	if (slope > 1 || slope < -1)
-	{
-		//y+
-		if (y0 > y1) { swap(x0, x1), swap(y0, y1); }
-		r = y0; rend = y1;
-		c = x0; cdiff = 0;
-		cinc = 1.f / slope;
-	}
-	else
-	{
-		//x+
-		if (x0 > x1) { swap(x0, x1), swap(y0, y1); }
-		r = x0; rend = x1;
-		c = y0; cdiff = 0;
-		cinc = slope;
-	}
-
-	float &x = (slope > 1 || slope < -1) ? c : r;
-	float &y = (slope > 1 || slope < -1) ? r : c;
-
-	while (r <= rend)
-	{
-		//Draw current pixel
-
-		int ix = floor(x);
-		int iy = floor(y);
-		if (ix < 0 || ix >= m_width) return;
-		if (iy < 0 || iy >= m_height) return;
-		unsigned char *pixel = &m_framebuffer[0] + 4 * (ix + iy * m_width);
-		float Oa = pixel[3];
-		float Na = color.a;
-		pixel[0] = (uint8_t)(color.r * 255. * Na + (1 - Na) * pixel[0]); //R
-		pixel[1] = (uint8_t)(color.g * 255. * Na + (1 - Na) * pixel[1]); //G
-		pixel[2] = (uint8_t)(color.b * 255. * Na + (1 - Na) * pixel[2]); //B
-		pixel[3] = (uint8_t)((1. - (1. - Oa) * (1. - Na)) * 255);	     //A
-
-		//Update r,c, cdiff
-		r += 1.f;
-		float caccudiff = cdiff + cinc;
-		if (caccudiff >= 0.5f)
+	if (!clipLine(x0, y0, x1, y1, 0.f, 0.f, (float)m_width, (float)m_height)) return;
+
+	m_mlaa.markSegment(x0, y0, x1, y1);
+
+	//End points on the right or bottom border of the viewport belong to the last pixel, and the ones
+	//the clipping rounded a hair before the left or top border to the first one
+	int ix0 = max(0, min((int)floor(x0), (int)m_width - 1)),  iy0 = max(0, min((int)floor(y0), (int)m_height - 1));
+	int ix1 = max(0, min((int)floor(x1), (int)m_width - 1)),  iy1 = max(0, min((int)floor(y1), (int)m_height - 1));
+
+	int dx = abs(ix1 - ix0), sx = ix0 < ix1 ? 1 : -1;
+	int dy = abs(iy1 - iy0), sy = iy0 < iy1 ? 1 : -1;
+	int err = dx - dy;
+
+	float Na = color.a;
+	float r = color.r * 255.f * Na, g = color.g * 255.f * Na, b = color.b * 255.f * Na;
+	unsigned char *pixel = &m_framebuffer[0] + 4 * (ix0 + iy0 * m_width);
+	int xStep = 4 * sx, yStep = 4 * sy * (int)m_width;
+	uint32_t *stamps = m_strokeStamp ? &m_strokeStamps[0] : NULL;
+
+	for (int steps = max(dx, dy); ; --steps)
+	{
+		//Draw current pixel, once in a translucent stroke whose lines share their end points
+		uint32_t *stamp = stamps ? stamps + (pixel - &m_framebuffer[0]) / 4 : NULL;
+		if (!stamp || *stamp != m_strokeStamp)
+		{
+			if (stamp) *stamp = m_strokeStamp;
+			float Oa = pixel[3];
+			pixel[0] = (uint8_t)(r + (1 - Na) * pixel[0]); //R
+			pixel[1] = (uint8_t)(g + (1 - Na) * pixel[1]); //G
+			pixel[2] = (uint8_t)(b + (1 - Na) * pixel[2]); //B
+			pixel[3] = (uint8_t)((1. - (1. - Oa) * (1. - Na)) * 255);	     //A
+		}
+		if (steps == 0) break;
+
+		int e2 = 2 * err;
+		if (e2 > -dy) { err -= dy; pixel += xStep; }
+		if (e2 <  dx) { err += dx; pixel += yStep; }
+	}
+}
+
+/*
+* Color of a batch of Wu lines, set up once for the batch.
+* Coverage weights are in [0, 256], the pixels are blended as (dst * (256 - w) + src * w) >> 8.
+*/
+struct WuPen
+{
+	WuPen(unsigned char *framebuffer, int width, int height, Color color)
+		: framebuffer(framebuffer), width(width), height(height)
+	{
+		src[0] = (int)(min(max(color.r, 0.f), 1.f) * 255.f + 0.5f);
+		src[1] = (int)(min(max(color.g, 0.f), 1.f) * 255.f + 0.5f);
+		src[2] = (int)(min(max(color.b, 0.f), 1.f) * 255.f + 0.5f);
+		src[3] = 255;
+		alpha = (int)(min(max(color.a, 0.f), 1.f) * 256.f + 0.5f);
+#ifdef RENDERER_SSE2
+		src16 = _mm_setr_epi16(src[0], src[1], src[2], src[3], src[0], src[1], src[2], src[3]);
+#endif
+	}
+
+	inline void blend(unsigned char *pixel, int w) const
+	{
+		pixel[0] = (unsigned char)((pixel[0] * (256 - w) + src[0] * w + 128) >> 8);
+		pixel[1] = (unsigned char)((pixel[1] * (256 - w) + src[1] * w + 128) >> 8);
+		pixel[2] = (unsigned char)((pixel[2] * (256 - w) + src[2] * w + 128) >> 8);
+		pixel[3] = (unsigned char)((pixel[3] * (256 - w) + src[3] * w + 128) >> 8);
+	}
+
+	/* Blend the two pixels of a step, both RGBA at once with SSE2*/
+	inline void blendPair(unsigned char *p0, unsigned char *p1, int w0, int w1) const
+	{
+#ifdef RENDERER_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		__m128i dst = _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(const int*)p0), _mm_cvtsi32_si128(*(const int*)p1));
+		dst = _mm_unpacklo_epi8(dst, zero);
+		__m128i w = _mm_setr_epi16(w0, w0, w0, w0, w1, w1, w1, w1);
+		__m128i sum = _mm_add_epi16(_mm_mullo_epi16(dst, _mm_sub_epi16(_mm_set1_epi16(256), w)), _mm_mullo_epi16(src16, w));
+		__m128i result = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+		result = _mm_packus_epi16(result, result);
+		*(int*)p0 = _mm_cvtsi128_si32(result);
+		*(int*)p1 = _mm_cvtsi128_si32(_mm_srli_si128(result, 4));
+#else
+		blend(p0, w0);
+		blend(p1, w1);
+#endif
+	}
+
+	unsigned char *framebuffer;
+	int			   width;
+	int			   height;
+	int			   src[4];
+	int			   alpha;   //[0, 256]
+#ifdef RENDERER_SSE2
+	__m128i		   src16;   //src of both pixels, 16 bit channels
+#endif
+};
+
+/*
+* Xiaolin Wu's line algorithm https://unionassets.com/blog/algorithm-brezenhema-and-wu-s-line-299
+* Each step along the major axis covers two pixels of the minor axis. The minor position is stepped in
+* 16.16 fixed point, with the half pixel offset folded in: its integer part is the first pixel of the pair
+* and its top 8 fraction bits the coverage of the second one.
+*/
+static void wuLine(const WuPen& pen, float x0, float y0, float x1, float y1)
+{
+	//The pixels of the line may be 1 pixel away from it
+	if (!clipLine(x0, y0, x1, y1, -1.f, -1.f, pen.width + 1.f, pen.height + 1.f)) return;
+
+	bool isSteep = fabs(y1 - y0) > fabs(x1 - x0);
+	if (isSteep) { swap(x0, y0); swap(x1, y1); }
+	if (x0 > x1) { swap(x0, x1); swap(y0, y1); }
+
+	float gradient = (x1 > x0) ? (y1 - y0) / (x1 - x0) : 0.f;
+	int x = (int)floor(x0), xend = (int)floor(x1);
+	float y = gradient * (x + 0.5f - x0) + y0;
+	int fy = (int)floor((y - 0.5f) * 65536.f + 0.5f);
+	int step = (int)floor(gradient * 65536.f + 0.5f);
+	bool isFlat = fabs(gradient) < 0.01f;
+
+	int majorSize	= isSteep ? pen.height : pen.width;
+	int minorSize	= isSteep ? pen.width : pen.height;
+	int majorStride = isSteep ? 4 * pen.width : 4;
+	int minorStride = isSteep ? 4 : 4 * pen.width;
+
+	for (; x <= xend; ++x, fy += step)
+	{
+		int iy = fy >> 16;
+		int cover = (fy >> 8) & 0xFF; //of the second pixel
+		if (isFlat && abs(cover - 128) <= 2)
 		{
-			c += 1.f;
-			cdiff = caccudiff - 1;
+			//A flat line on a pixel boundary would be half lit on both rows, keep the row it is in
+			if (cover >= 128) ++iy;
+			cover = 0;
 		}
-		else if (caccudiff <= -0.5f)
+		int w1 = (pen.alpha * cover) >> 8;
+		int w0 = (pen.alpha * (256 - cover)) >> 8;
+
+		if ((unsigned)x >= (unsigned)majorSize) continue;
+		unsigned char *pixel = pen.framebuffer + x * majorStride;
+		if ((unsigned)iy < (unsigned)(minorSize - 1))
 		{
-			c -= 1.f;
-			cdiff = caccudiff + 1;
+			pen.blendPair(pixel + iy * minorStride, pixel + (iy + 1) * minorStride, w0, w1);
 		}
 		else
 		{
-			cdiff = caccudiff;
+			if ((unsigned)iy < (unsigned)minorSize)		  pen.blend(pixel + iy * minorStride, w0);
+			if ((unsigned)(iy + 1) < (unsigned)minorSize) pen.blend(pixel + (iy + 1) * minorStride, w1);
 		}
 	}
 }
 
 /*
-* Raterize a line with antialiasing.
-* Use Xiaolin Wu's line algorithm https://unionassets.com/blog/algorithm-brezenhema-and-wu-s-line-299
+* Raterize a line with antialiasing, see wuLine.
 */
 void SoftwareRenderer::rasterizeLineAntialiasing(float x0, float y0, float x1, float y1, Color color, float width)
 {
-	bool isSteep = abs(y0 - y1) > abs(x0 - x1);
-	if ( isSteep ) { swap(x0, y0); swap(x1, y1); }
-	if (x0 > x1) { swap(x0, x1); swap(y0, y1); }
+	m_mlaa.markSegment(x0, y0, x1, y1);
+	wuLine(WuPen(&m_framebuffer[0], (int)m_width, (int)m_height, color), x0, y0, x1, y1);
+}
 
-	float gradient = (y1 - y0) / (x1 - x0);
+/*
+* Raterize the lines of the polyline points[0, count) with antialiasing. The lines share the color setup, 
+* which makes batches of short lines (wireframes, thin strokes) cheap.
+*/
+void SoftwareRenderer::rasterizeLinesAntialiasing(const Vector2D* points, size_t count, bool closed, Color color)
+{
+	if (count < 2) return;
+	WuPen pen(&m_framebuffer[0], (int)m_width, (int)m_height, color);
+	if (pen.alpha == 0) return;
 
-	float x = floor(x0) + 0.5,  xend = floor(x1) + 0.5;
-	float y = gradient * (x - x0) + y0;
-	
-	for (; x <= xend; x += 1.f, y += gradient)
+	for (size_t i = closed ? 0 : 1; i < count; ++i)
 	{
-		float xs = x;
-		float ys = floor(y) + 0.5;
-		//Draw current two pixels
-		float diff = y - ys;	 // diff = y - ysample point, sample piont(xs, floor(y) + 0.5)
-		if (diff >= 0)
-		{
-			//Draw (xs, ys) (xs, ys + 1)
-			if (abs(gradient) < 0.01 && abs(diff - 0.5f) < 0.01 ) { diff = 0.f; } // Prevent the line from be to light in color
-			if (isSteep)
-			{
-				rasterizePoint(ys,       xs, (1.f - diff) * color);
-				rasterizePoint(ys + 1.f, xs, diff         * color);
-			}
-			else
-			{
-				rasterizePoint(xs, ys,       (1.f - diff) * color);
-				rasterizePoint(xs, ys + 1.f, diff         * color);
-			}
-		}
-		else
-		{
-			//Draw (xs, ys) (xs, ys - 1)
-			if (abs(gradient) < 0.01 && abs(diff + 0.5f) < 0.01) { diff = 0.f; }
-			if (isSteep)
-			{
-				rasterizePoint(ys,       xs, (1.f + diff) * color);
-				rasterizePoint(ys - 1.f, xs, -diff        * color);
-			}
-			else
-			{
-				rasterizePoint(xs, ys,        (1.f + diff) * color);
-				rasterizePoint(xs, ys - 1.f,  - diff       * color);
-			}
-			
+		const Vector2D &p0 = points[i == 0 ? count - 1 : i - 1], &p1 = points[i];
+		m_mlaa.markSegment(p0.x, p0.y, p1.x, p1.y);
+		wuLine(pen, p0.x, p0.y, p1.x, p1.y);
+	}
+}
 
+//Triangles are clipped to the screen extended by this many pixels on each side
+static const float kGuardBand = 4096.f;
+
+struct ClipVertex
+{
+	double x, y;
+};
+
+/*
+* Clip the convex polygon in[0, n) to the half plane sign * (x or y) <= bound, axis 0 being x and 1 being y.
+* Writes the clipped polygon to out and returns its vertex count, one more than n at most.
+*/
+static int clipPolygon(const ClipVertex* in, int n, ClipVertex* out, int axis, double sign, double bound)
+{
+	int count = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		const ClipVertex &a = in[i], &b = in[(i + 1) % n];
+		double da = sign * (axis == 0 ? a.x : a.y) - bound;
+		double db = sign * (axis == 0 ? b.x : b.y) - bound;
+		if (da <= 0.) out[count++] = a;
+		if ((da < 0. && db > 0.) || (da > 0. && db < 0.))
+		{
+			double t = da / (da - db);
+			ClipVertex v = { a.x + t * (b.x - a.x), a.y + t * (b.y - a.y) };
+			out[count++] = v;
 		}
 	}
+	return count;
 }
 
 /* Rasterize a triangle
@@ -325,18 +626,57 @@ void SoftwareRenderer::rasterizeLineAntialiasing(float x0, float y0, float x1, f
 *|        | 		  |
 *|__ __ __|__ __ __ __|
 *
-* We first find the whole bounding box of the tringle, then we test each block in the bounding box.
+* We first find the bounding box of the tringle, clamped to the screen, then we test each block in the bounding box.
 * We use the early out strategy, if the pixels on the edges of the block not in the triangle, the whole 
 * block will not across the triangle.
+* Triangles reaching out of the guard band around the screen are clipped to it first, so the edge
+* equations never see the huge coordinates of deep zooms.
 */
 void SoftwareRenderer::rasterizeTriangle(float x0, float y0, float x1, float y1, float x2, float y2, Color color)
 {
-	//1. Construct the 3 edges.
+	float gxmin = -kGuardBand, gxmax = m_width + kGuardBand;
+	float gymin = -kGuardBand, gymax = m_height + kGuardBand;
+	if (min({ x0, x1, x2 }) >= gxmin && max({ x0, x1, x2 }) <= gxmax &&
+		min({ y0, y1, y2 }) >= gymin && max({ y0, y1, y2 }) <= gymax)
+	{
+		//The edge pixels are where MLAA will look for discontinuities
+		m_mlaa.markSegment(x0, y0, x1, y1);
+		m_mlaa.markSegment(x1, y1, x2, y2);
+		m_mlaa.markSegment(x2, y2, x0, y0);
+		fillTriangle(x0, y0, x1, y1, x2, y2, color);
+		return;
+	}
+
+	//Sutherland-Hodgman against the 4 sides of the guard band, in double precision
+	ClipVertex polygon[2][8] = { { { x0, y0 }, { x1, y1 }, { x2, y2 } } };
+	int n = 3, cur = 0;
+	n = clipPolygon(polygon[cur], n, polygon[1 - cur], 0, -1., -gxmin); cur = 1 - cur;
+	n = clipPolygon(polygon[cur], n, polygon[1 - cur], 0,  1.,  gxmax); cur = 1 - cur;
+	n = clipPolygon(polygon[cur], n, polygon[1 - cur], 1, -1., -gymin); cur = 1 - cur;
+	n = clipPolygon(polygon[cur], n, polygon[1 - cur], 1,  1.,  gymax); cur = 1 - cur;
+
+	const ClipVertex *p = polygon[cur];
+	for (int i = 0; i < n; ++i)
+	{
+		const ClipVertex &a = p[i], &b = p[(i + 1) % n];
+		m_mlaa.markSegment((float)a.x, (float)a.y, (float)b.x, (float)b.y);
+	}
+	for (int i = 1; i + 1 < n; ++i)
+	{
+		fillTriangle((float)p[0].x,	 (float)p[0].y,
+					 (float)p[i].x,	 (float)p[i].y,
+					 (float)p[i + 1].x, (float)p[i + 1].y, color);
+	}
+}
+
+void SoftwareRenderer::fillTriangle(float x0, float y0, float x1, float y1, float x2, float y2, Color color)
+{
+	//1. Construct the 3 edges
 	Triangle triangle(x0, y0, x1, y1, x2, y2);
 	
-	//2. Find the Bounding box range of the triangle
-	float xmin = min({ x0, x1, x2 }), ymin = min({y0, y1, y2});
-	float xmax = max({ x0, x1, x2 }), ymax = max({y0, y1, y2});
+	//2. Find the Bounding box range of the triangle, on the screen
+	float xmin = max(min({ x0, x1, x2 }), 0.f), ymin = max(min({y0, y1, y2}), 0.f);
+	float xmax = min(max({ x0, x1, x2 }), m_width - 1.f), ymax = min(max({y0, y1, y2}), m_height - 1.f);
 
 	//3. Test the points in inner Bounding box with size 10 * 10
 	float len = 10.f;
@@ -348,6 +688,15 @@ void SoftwareRenderer::rasterizeTriangle(float x0, float y0, float x1, float y1,
 			//Test if the 
 			bool isCross = false; //if this inner bounding box edges across the triangle
 
+			//A small triangle may lie inside the box without covering any pixel of its edges
+			float xbmax = xbmin + len, ybmax = ybmin + len;
+			if ((x0 >= xbmin && x0 < xbmax && y0 >= ybmin && y0 < ybmax) ||
+				(x1 >= xbmin && x1 < xbmax && y1 >= ybmin && y1 < ybmax) ||
+				(x2 >= xbmin && x2 < xbmax && y2 >= ybmin && y2 < ybmax))
+			{
+				isCross = true;
+			}
+
 			float xsbmin = xbmin + 0.5, xsbmax = xsbmin + len - 1.f;
 			float ysbmin = ybmin + 0.5, ysbmax = ysbmin + len - 1.f;
 
@@ -411,140 +760,349 @@ void SoftwareRenderer::rasterizeTriangle(float x0, float y0, float x1, float y1,
 
 }
 
-void SoftwareRenderer::rasterizeImage(float x0, float y0, float x1, float y1, const Texture& tex)
+/* Narrow [lo, hi] to the x where 0 <= k * x + c <= 1*/
+static inline void clipUnitInterval(double k, double c, double& lo, double& hi)
+{
+	if (k == 0.)
+	{
+		if (c < 0. || c > 1.) hi = lo - 1.;
+		return;
+	}
+	double xa = -c / k, xb = (1. - c) / k;
+	if (xa > xb) swap(xa, xb);
+	lo = max(lo, xa);
+	hi = min(hi, xb);
+}
+
+/*
+* Blend the count RGBA pixels of src over dst, the colors weighted by the alpha of src as in rasterizePoint
+* and the alphas composited. The weights are 8 bit, an alpha of 255 weighs 256 and copies the pixel as is.
+*/
+static void blendSpan(const unsigned char* src, size_t count, unsigned char* dst)
+{
+	//Most images are opaque, their spans are copied
+	bool opaque = true;
+	for (size_t i = 3; i < 4 * count && opaque; i += 4) opaque = src[i] == 255;
+	if (opaque)
+	{
+		memcpy(dst, src, 4 * count);
+		return;
+	}
+
+	size_t i = 0;
+#ifdef RENDERER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(256), round = _mm_set1_epi16(128);
+	const __m128i srcAlpha = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255); //the alpha composites toward 255
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + 4 * i)), zero);
+		__m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(dst + 4 * i)), zero);
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i w = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+		s = _mm_or_si128(s, srcAlpha);
+		//at most 255 * 256 + 128, the sums fit the unsigned 16 bit lanes
+		__m128i sum = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(one, w)), _mm_mullo_epi16(s, w));
+		__m128i result = _mm_srli_epi16(_mm_add_epi16(sum, round), 8);
+		_mm_storel_epi64((__m128i*)(dst + 4 * i), _mm_packus_epi16(result, result));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		const unsigned char *s = src + 4 * i;
+		unsigned char *d = dst + 4 * i;
+		int w = s[3] + (s[3] >> 7);
+		d[0] = (unsigned char)((d[0] * (256 - w) + s[0] * w + 128) >> 8);
+		d[1] = (unsigned char)((d[1] * (256 - w) + s[1] * w + 128) >> 8);
+		d[2] = (unsigned char)((d[2] * (256 - w) + s[2] * w + 128) >> 8);
+		d[3] = (unsigned char)((d[3] * (256 - w) + 255 * w + 128) >> 8);
+	}
+}
+
+/*
+* Rasterize an image mapped to the screen by the affine transformation uvToScreen, from the unit square
+* of its texture coordinates. Each row is a span of the pixels whose center maps into the unit square,
+* found and sampled with the inverse transformation, so rotated and skewed images cost the same as
+* axis aligned ones.
+* The mip level(s) are chosen once for the whole image, from the texels covered by a pixel.
+* The samples keep the alpha of the texture, each span is blended over the framebuffer by blendSpan.
+*/
+void SoftwareRenderer::rasterizeImage(const Matrix3x3& uvToScreen, const Texture& tex)
 {
-	float w = x1 - x0, h = y1 - y0;
-	for (float y = floor(y0) + 0.5; y < y1; ++y)
+	Vector2D corners[4] = { transform(Vector2D(0., 0.), uvToScreen), transform(Vector2D(1., 0.), uvToScreen),
+							transform(Vector2D(1., 1.), uvToScreen), transform(Vector2D(0., 1.), uvToScreen) };
+
+	//Only the image border is antialiased, not its content
+	for (int i = 0; i < 4; ++i)
 	{
-		float v = (y - y0) / h;
-		for (float x = floor(x0) + 0.5; x < x1; ++x)
+		const Vector2D &a = corners[i], &b = corners[(i + 1) % 4];
+		m_mlaa.markSegment(a.x, a.y, b.x, b.y);
+	}
+
+	double det = uvToScreen(0, 0) * uvToScreen(1, 1) - uvToScreen(0, 1) * uvToScreen(1, 0);
+	if (!(fabs(det) > 1e-12) || tex.levelCount() == 0) return;
+	//The last row of the inverse is (0, 0, 1 / w) for the homogeneous view transformation
+	Matrix3x3 screenToUV = uvToScreen.inv();
+	screenToUV /= screenToUV(2, 2);
+	double ux = screenToUV(0, 0), uy = screenToUV(0, 1), u0 = screenToUV(0, 2);
+	double vx = screenToUV(1, 0), vy = screenToUV(1, 1), v0 = screenToUV(1, 2);
+
+	double ymin = min(min(corners[0].y, corners[1].y), min(corners[2].y, corners[3].y));
+	double ymax = max(max(corners[0].y, corners[1].y), max(corners[2].y, corners[3].y));
+	int yBegin = (int)max(ceil(ymin - 0.5), 0.), yEnd = (int)min(ceil(ymax - 0.5), (double)m_height);
+
+	//Level of detail from the level 0 texels covered along the screen axes, constant for an affine mapping
+	double texelsX = sqrt((ux * tex.width) * (ux * tex.width) + (vx * tex.height) * (vx * tex.height));
+	double texelsY = sqrt((uy * tex.width) * (uy * tex.width) + (vy * tex.height) * (vy * tex.height));
+	double lod = log2(max(max(texelsX, texelsY), 1.));
+	int maxLevel = (int)tex.levelCount() - 1;
+	int level = min((int)lod, maxLevel);
+	int weight = level < maxLevel ? (int)((lod - level) * 256.) : 0; //of level + 1
+	//Close to a level, sample it alone
+	if (weight < 16)	   weight = 0;
+	else if (weight > 240) { ++level; weight = 0; }
+
+	for (int y = yBegin; y < yEnd; ++y)
+	{
+		//u = ux * x + uc, v = vx * x + vc along the row
+		double yc = y + 0.5;
+		double uc = uy * yc + u0, vc = vy * yc + v0;
+		double lo = 0., hi = m_width;
+		clipUnitInterval(ux, uc, lo, hi);
+		clipUnitInterval(vx, vc, lo, hi);
+
+		int xBegin = (int)max(ceil(lo - 0.5), 0.), xEnd = (int)min(ceil(hi - 0.5), (double)m_width);
+		if (xBegin >= xEnd) continue;
+
+		double xc = xBegin + 0.5;
+		float u = (float)(ux * xc + uc), v = (float)(vx * xc + vc);
+		unsigned char *span = &m_imageSpan[0];
+		if (weight == 0)
 		{
-			float u = (x - x0) / w;
-			//Color c = Sampler2D::sampleNearest(tex, u, v);
-			Color c = Sampler2D::sampleBilinear(tex, u, v);
-			//Color c = Sampler2D::sampleTrilinear(tex, u, v, 1.0 / w, 1.0 / h);
-			rasterizePoint(x, y, c);
+			Sampler2D::sampleBilinearSpan(tex, level, u, v, (float)ux, (float)vx, xEnd - xBegin, span);
 		}
+		else
+		{
+			Sampler2D::sampleTrilinearSpan(tex, level, weight, u, v, (float)ux, (float)vx, xEnd - xBegin, span, &m_spanScratch[0]);
+		}
+		blendSpan(span, xEnd - xBegin, &m_framebuffer[0] + 4 * (xBegin + y * m_width));
 	}
 }
 
-void SoftwareRenderer::drawSVGElement(const SVGElement* element, Matrix3x3 transMtx)
+void SoftwareRenderer::drawItem(uint32_t index, const Matrix3x3& transMtx)
 {
-	switch (element->type)
+	const Scene::Item& item = m_scene.items[index];
+	switch (item.type)
 	{
 	case POINT:
-		drawSVGPoint(element, transMtx);
+		drawSVGPoint(item, transMtx);
 		break;
 	case LINE:
-		drawSVGLine(element, transMtx);
+		drawSVGLine(index, transMtx);
+		break;
+	case POLYLINE:
+		drawSVGPolyline(index, transMtx);
 		break;
 	case RECT:
-		drawSVGRect(element, transMtx);
+		drawSVGRect(index, transMtx);
 		break;
 	case POLYGON:
-		drawSVGPolygon(element, transMtx);
+		drawSVGPolygon(index, transMtx);
 		break;
-	case GROUP:
-		drawSVGGroup(element, transMtx);
 	case IMAGE:
-		drawSVGImage(element, transMtx);
+		drawSVGImage(item, transMtx);
+		break;
 	default:
 		break;
 	}
 }
 
-void SoftwareRenderer::drawSVGPoint(const SVGElement* element, Matrix3x3 transMtx)
+void SoftwareRenderer::drawSVGPoint(const Scene::Item& item, const Matrix3x3& transMtx)
 {
-	const Point& point = static_cast<const Point&>(*element);
-	Vector2D p = transform(point.position, transMtx * point.transform);
-	rasterizePoint(p.x, p.y, point.style.strokeColor);
+	Vector2D p = transform(Vector2D(m_scene.x[item.first], m_scene.y[item.first]), transMtx);
+	m_mlaa.markSegment(p.x, p.y, p.x, p.y);
+	rasterizePoint(p.x, p.y, m_scene.styles[item.style].strokeColor);
 }
 
-void SoftwareRenderer::drawSVGLine(const SVGElement* element, Matrix3x3 transMtx)
+void SoftwareRenderer::drawSVGLine(uint32_t index, const Matrix3x3& transMtx)
 {
-	const Line& line = static_cast<const Line&>(*element);
-	Vector2D from	= transform(line.from, transMtx * line.transform);
-	Vector2D to		= transform(line.to,   transMtx * line.transform);
-	rasterizeLine(from.x, from.y, to.x, to.y, line.style.strokeColor);
+	const Scene::Item& item = m_scene.items[index];
+	drawStroke(m_scene.styles[item.style], index, &m_scene.x[item.first], &m_scene.y[item.first], 2, false, transMtx);
 }
 
-void SoftwareRenderer::drawSVGRect(const SVGElement* element, Matrix3x3 transMtx)
+void SoftwareRenderer::drawSVGPolyline(uint32_t index, const Matrix3x3& transMtx)
 {
-	const Rect& rect = static_cast<const Rect&>(*element);
-	Vector2D p0 = transform(rect.position,					transMtx * rect.transform);
-	Vector2D p1 = transform(rect.position + rect.dimension,	transMtx * rect.transform);
-	
-	Color color = rect.style.strokeColor;
-	if ( color.a != 0)
-	{
-		rasterizeLine(p0.x,p0.y,  p1.x,p0.y,  color);
-		rasterizeLine(p0.x,p0.y,  p0.x,p1.y,  color);
-		rasterizeLine(p1.x,p1.y,  p1.x,p0.y,  color);
-		rasterizeLine(p1.x,p1.y,  p0.x,p1.y,  color);
-	}
+	const Scene::Item& item = m_scene.items[index];
+	drawStroke(m_scene.styles[item.style], index, &m_scene.x[item.first], &m_scene.y[item.first], item.count, false, transMtx);
+}
 
-	color = rect.style.fillColor;
+void SoftwareRenderer::drawSVGRect(uint32_t index, const Matrix3x3& transMtx)
+{
+	const Scene::Item& item = m_scene.items[index];
+	Vector2D position(m_scene.x[item.first], m_scene.y[item.first]);
+	Vector2D dimension(m_scene.x[item.first + 1], m_scene.y[item.first + 1]);
+	Vector2D p0 = transform(position,				transMtx);
+	Vector2D p1 = transform(position + dimension,	transMtx);
+	
+	Color color = m_scene.styles[item.style].fillColor;
 	if (color.a != 0)
 	{
 		rasterizeTriangle(p0.x,p0.y, p0.x,p1.y,  p1.x,p1.y, color);
 		rasterizeTriangle(p0.x,p0.y, p1.x,p0.y,  p1.x,p1.y, color);
 	}
+
+	//The outline is drawn over the fill
+	float cornersX[4] = { (float)position.x, (float)(position.x + dimension.x), (float)(position.x + dimension.x), (float)position.x };
+	float cornersY[4] = { (float)position.y, (float)position.y, (float)(position.y + dimension.y), (float)(position.y + dimension.y) };
+	drawStroke(m_scene.styles[item.style], index, cornersX, cornersY, 4, true, transMtx);
 }
 
-void SoftwareRenderer::drawSVGPolygon(const SVGElement* element, Matrix3x3 transMtx)
+void SoftwareRenderer::drawSVGPolygon(uint32_t index, const Matrix3x3& transMtx)
 {
-	const Polygon& poly = static_cast<const Polygon&>(*element);
-	vector<Vector2D> trgls;
-	triangulate(poly, trgls);
+	const Scene::Item& item = m_scene.items[index];
+	if (item.count == 0) return;
+
+	const float* x = &m_scene.x[item.first];
+	const float* y = &m_scene.y[item.first];
 
-	for (Vector2D& p : trgls)
+	//The fill was triangulated by Scene::build, each vertex is transformed once
+	Color color = m_scene.styles[item.style].fillColor;
+	if (color.a != 0 && item.indexCount != 0)
 	{
-		p = transform(p, transMtx * poly.transform);
+		m_polygonPoints.resize(item.count);
+		for (uint32_t i = 0; i < item.count; ++i)
+		{
+			m_polygonPoints[i] = transform(Vector2D(x[i], y[i]), transMtx);
+		}
+
+		const uint32_t* indices = &m_scene.indices[item.firstIndex];
+		for (uint32_t i = 0; i + 2 < item.indexCount; i+=3)
+		{
+			const Vector2D& a = m_polygonPoints[indices[i]];
+			const Vector2D& b = m_polygonPoints[indices[i + 1]];
+			const Vector2D& c = m_polygonPoints[indices[i + 2]];
+			rasterizeTriangle(a.x, a.y, b.x, b.y, c.x, c.y, color);
+		}
 	}
+	
+	drawStroke(m_scene.styles[item.style], index, x, y, item.count, true, transMtx);
+}
 
-	Color color = poly.style.fillColor;
-	if (color.a != 0)
+void SoftwareRenderer::drawSVGImage(const Scene::Item& item, const Matrix3x3& transMtx)
+{
+	const Texture* tex = m_scene.textures[item.texture];
+	Matrix3x3 uvToImage = Matrix3x3::identity();
+	uvToImage(0, 0) = m_scene.x[item.first + 1]; uvToImage(0, 2) = m_scene.x[item.first];
+	uvToImage(1, 1) = m_scene.y[item.first + 1]; uvToImage(1, 2) = m_scene.y[item.first];
+
+	if (tex) rasterizeImage(transMtx * uvToImage, *tex);
+}
+
+/*
+* Draw the stroke of the polyline (x, y)[0, count), given in the element space.
+* Strokes up to kThinStroke pixels wide are drawn as 1 pixel lines, antialiased with Wu's algorithm
+* unless MLAA will antialias the frame. The wider ones are expanded
+* into triangles by strokePolyline and filled. The triangles are cached by key, the scene item, and zoom bucket,
+* since the zoom only changes how finely the round joins and caps are tessellated.
+* The triangles overlap at the joins, as do the 1 pixel lines at their end points: a translucent stroke is
+* stenciled so that each of its pixels is blended once.
+*/
+void SoftwareRenderer::drawStroke(const Style& style, uint32_t key, const float* x, const float* y, size_t count, bool closed, const Matrix3x3& transMtx)
+{
+	static const float kThinStroke = 1.5f;
+
+	Color color = style.strokeColor;
+	if (color.a == 0 || !(style.strokeWidth > 0.f) || count == 0) return;
+
+	//Scale of the element to screen transformation, the mean of its axis scales. 
+	//The view transformation is homogeneous, with its scale in the last row.
+	double scale = sqrt(fabs(transMtx(0, 0) * transMtx(1, 1) - transMtx(0, 1) * transMtx(1, 0))) / fabs(transMtx(2, 2));
+	if (style.strokeWidth * scale <= kThinStroke && m_wuLines && m_aaMode != AA_MLAA)
 	{
-		for (int i = 0; i < trgls.size(); i+=3)
+		m_strokePoints.resize(count);
+		for (size_t i = 0; i < count; ++i)
 		{
-			rasterizeTriangle(	trgls[i].x,     trgls[i].y, 
-								trgls[i + 1].x, trgls[i + 1].y, 
-								trgls[i + 2].x, trgls[i + 2].y, 
-								color);
+			m_strokePoints[i] = transform(Vector2D(x[i], y[i]), transMtx);
 		}
+		rasterizeLinesAntialiasing(&m_strokePoints[0], count, closed, color);
+		return;
 	}
-	
-	color = poly.style.strokeColor;
-	if (color.a != 0)
+	if (style.strokeWidth * scale <= kThinStroke)
 	{
-		int nPoints = poly.points.size();
-		for (int i = 0; i < nPoints; ++i)
+		beginStroke(color);
+		size_t first = closed ? count - 1 : 0;
+		Vector2D p0 = transform(Vector2D(x[first], y[first]), transMtx);
+		for (size_t i = closed ? 0 : 1; i < count; ++i)
 		{
-			Vector2D p0 = transform(poly.points[i % nPoints],		transMtx * poly.transform);
-			Vector2D p1 = transform(poly.points[(i + 1)% nPoints],  transMtx * poly.transform);
-			rasterizeLine(p0.x,p0.y, p1.x,p1.y, color);
+			Vector2D p1 = transform(Vector2D(x[i], y[i]), transMtx);
+			rasterizeLine(p0.x, p0.y, p1.x, p1.y, color);
+			p0 = p1;
 		}
+		endStroke();
+		return;
 	}
 
+	//Half octave buckets, tessellated with a quarter pixel tolerance at the largest scale of the bucket
+	int bucket = (int)floor(2. * log2(scale));
+	unordered_map<uint32_t, StrokeMesh>::iterator it = m_strokeCache.find(key);
+	if (it == m_strokeCache.end() || it->second.zoomBucket != bucket)
+	{
+		StrokeMesh& mesh = m_strokeCache[key];
+		mesh.zoomBucket = bucket;
+		strokePolyline(x, y, count, closed, style, (float)(0.25 / pow(2., (bucket + 1) / 2.)), mesh.triangles);
+		it = m_strokeCache.find(key);
+	}
 
+	const vector<Vector2D>& triangles = it->second.triangles;
+	beginStroke(color);
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3)
+	{
+		Vector2D a = transform(triangles[i],	 transMtx);
+		Vector2D b = transform(triangles[i + 1], transMtx);
+		Vector2D c = transform(triangles[i + 2], transMtx);
+		rasterizeTriangle(a.x, a.y, b.x, b.y, c.x, c.y, color);
+	}
+	endStroke();
 }
 
-void SoftwareRenderer::drawSVGGroup(const SVGElement* element, Matrix3x3 transMtx)
+/*
+* Start stenciling the pixels of a translucent stroke, until endStroke. The pixels are stamped with the number
+* of the stroke, and the stamps are only cleared when the numbers wrap around. Opaque strokes may blend a
+* pixel twice with the same result.
+*/
+void SoftwareRenderer::beginStroke(Color color)
 {
-	const Group& group = static_cast<const Group&>(*element);
-	for (size_t i = 0; i < group.elements.size(); i++)
-	{	
-		drawSVGElement(group.elements[i], transMtx * group.transform);
+	if (color.a >= 1.f) return;
+	if (m_strokeStamps.size() != m_width * m_height)
+	{
+		m_strokeStamps.assign(m_width * m_height, 0);
+		m_strokeCount = 0;
 	}
+	if (++m_strokeCount == 0)
+	{
+		fill(m_strokeStamps.begin(), m_strokeStamps.end(), 0);
+		m_strokeCount = 1;
+	}
+	m_strokeStamp = m_strokeCount;
+}
+
+int SoftwareRenderer::saveFramebuffer(const char* filename, PNGParser::Compression compression) const
+{
+	//The rows are top down, as in a png
+	if (m_framebuffer.empty()) return -1;
+	return PNGParser::save(filename, &m_framebuffer[0], (int)m_width, (int)m_height, compression);
 }
 
-void SoftwareRenderer::drawSVGImage(const SVGElement* element, Matrix3x3 transMtx)
+int SoftwareRenderer::saveFramebuffer(const char* filename, SnapshotWriter::Format format) const
 {
-	const Image& image = static_cast<const Image&>(*element);
-	Vector2D p0 = transform(image.position,					  transMtx * image.transform);
-	Vector2D p1 = transform(image.position + image.dimension, transMtx * image.transform);
+	if (m_framebuffer.empty()) return -1;
+	return SnapshotWriter::save(filename, &m_framebuffer[0], (int)m_width, (int)m_height, format);
+}
 
-	rasterizeImage(p0.x, p0.y, p1.x, p1.y, image.tex);
+int SoftwareRenderer::writeFramebuffer(int fd, SnapshotWriter::Format format) const
+{
+	if (m_framebuffer.empty()) return -1;
+	return SnapshotWriter::write(fd, &m_framebuffer[0], (int)m_width, (int)m_height, format);
 }
 
 void SoftwareRenderer::displayPixels()
@@ -2,13 +2,19 @@
 #define SORTWARE_RENDER_H
 
 #include "matrix3x3.h"
+#include "mlaa.h"
+#include "fxaa.h"
+#include "stroke.h"
+#include "png.h"
+#include "snapshot.h"
+#include "scene.h"
 #include <vector>
+#include <unordered_map>
 
 namespace CGCore
 {
 
 struct SVG;
-struct SVGElement;
 struct Color;
 struct Texture;
 
@@ -16,8 +22,16 @@ class SoftwareRenderer
 {
 
 public:
+	enum AAMode
+	{
+		AA_NONE = 0,
+		AA_MLAA,
+		AA_FXAA,
+		AA_MODE_COUNT,
+	};
+
 	SoftwareRenderer() : 
-		m_cursorX(0.f), m_cursorY(0.f)
+		m_cursorX(0.f), m_cursorY(0.f), m_aaMode(AA_MLAA), m_reportTiming(false), m_wuLines(true), m_strokeStamp(0), m_strokeCount(0)
 	{}
 	~SoftwareRenderer() {}
 
@@ -38,6 +52,37 @@ public:
 	void updateViewport(float ux, float uy, float uspan);
 
 	void redraw();
+
+	void setMLAAEdgeDetection(MLAntialias::EdgeDetection detection, int threshold)
+	{
+		m_mlaa.setEdgeDetection(detection, threshold);
+	}
+
+	MLAntialias::EdgeDetection mlaaEdgeDetection() const { return m_mlaa.edgeDetection(); }
+
+	void   setAAMode(AAMode mode) { m_aaMode = mode; }
+
+	AAMode aaMode() const { return m_aaMode; }
+
+	static const char* aaModeName(AAMode mode);
+
+	/* Print the draw and antialiasing time of each frame*/
+	void   setTimingReport(bool report) { m_reportTiming = report; }
+
+	bool   timingReport() const { return m_reportTiming; }
+
+	/* Draw the thin strokes as Wu lines when MLAA is off*/
+	void   setWuLines(bool wu) { m_wuLines = wu; }
+
+	bool   wuLines() const { return m_wuLines; }
+
+	/* Write the last frame to a png file, encoded straight from the framebuffer. Returns 0 on success*/
+	int    saveFramebuffer(const char* filename, PNGParser::Compression compression = PNGParser::COMPRESSION_DEFAULT) const;
+
+	/* Dump the last frame as QOI, raw RGBA or ppm, to a file or an open file descriptor such as a pipe*/
+	int    saveFramebuffer(const char* filename, SnapshotWriter::Format format) const;
+
+	int    writeFramebuffer(int fd, SnapshotWriter::Format format) const;
 	
 	float	m_cursorX;
 	float	m_cursorY;
@@ -55,29 +100,48 @@ private:
 
 	void rasterizeLineAntialiasing(float x0, float y0, float x1, float y1, Color color, float width = 1.0f);
 
+	void rasterizeLinesAntialiasing(const Vector2D* points, size_t count, bool closed, Color color);
+
 	void rasterizeTriangle(float x0, float y0, float x1, float y1, float x2, float y2, Color color);
 
-	void rasterizeImage(float x0, float y0, float x1, float y1, const Texture& tex);
+	void fillTriangle(float x0, float y0, float x1, float y1, float x2, float y2, Color color);
+
+	void rasterizeImage(const Matrix3x3& uvToScreen, const Texture& tex);
 	/*for testing of MLAA*/
 	void rasterizeMLAA_case1();
 
+	/*for testing of the line clipping*/
+	void rasterizeClipping_case1();
+
+	/*for testing of the translucent strokes, false if a pixel was blended twice*/
+	bool drawStroke_case1();
+
+	/*for testing of the translucent images, false if a pixel wasn't blended over the fill below*/
+	bool rasterizeImage_case1();
+
 private:
 	//SVG Element drawing
 	void drawSVG();
 
-	void drawSVGElement(const SVGElement* element, Matrix3x3 transMtx);
+	void drawItem(uint32_t index, const Matrix3x3& transMtx);
+
+	void drawSVGPoint(const Scene::Item& item, const Matrix3x3& transMtx);
+
+	void drawSVGLine(uint32_t index, const Matrix3x3& transMtx);
+
+	void drawSVGPolyline(uint32_t index, const Matrix3x3& transMtx);
 
-	void drawSVGPoint(const SVGElement* element, Matrix3x3 transMtx);
+	void drawSVGRect(uint32_t index, const Matrix3x3& transMtx);
 
-	void drawSVGLine(const SVGElement* element, Matrix3x3 transMtx);
+	void drawSVGPolygon(uint32_t index, const Matrix3x3& transMtx);
 
-	void drawSVGRect(const SVGElement* element, Matrix3x3 transMtx);
+	void drawSVGImage(const Scene::Item& item, const Matrix3x3& transMtx);
 
-	void drawSVGPolygon(const SVGElement* element, Matrix3x3 transMtx);
+	void drawStroke(const Style& style, uint32_t key, const float* x, const float* y, size_t count, bool closed, const Matrix3x3& transMtx);
 
-	void drawSVGGroup(const SVGElement* element, Matrix3x3 transMtx);
+	void beginStroke(Color color);
 
-	void drawSVGImage(const SVGElement* element, Matrix3x3 transMtx);
+	void endStroke() { m_strokeStamp = 0; }
 
 	inline Vector2D	  transform(const Vector2D &point, Matrix3x3 transMtx)
 	{
@@ -90,7 +154,28 @@ private:
 	Matrix3x3  getSVGToNDC();
 
 	const SVG				   *m_svg;
+	Scene						m_scene;
+	std::vector<Matrix3x3>		m_screenTransforms; //the scene transforms composed with the view, per frame
+	std::vector<Vector2D>		m_polygonPoints;	//vertices of the polygon being filled, in screen space
 	std::vector<unsigned char>  m_framebuffer;
+	std::vector<unsigned char>  m_spanScratch; //one row of pixels
+	std::vector<unsigned char>  m_imageSpan;   //the samples of one row of an image, before blending
+
+	//antialiasing, kept across frames
+	AAMode						m_aaMode;
+	MLAntialias					m_mlaa;
+	FXAntialias					m_fxaa;
+	bool						m_reportTiming;
+
+	//tessellated strokes by item, cleared when the svg changes
+	std::unordered_map<uint32_t, StrokeMesh> m_strokeCache;
+	std::vector<Vector2D>		m_strokePoints; //thin stroke in screen space
+	bool						m_wuLines;
+
+	//number of the translucent stroke being drawn by pixel, so that each pixel is blended once per stroke
+	std::vector<uint32_t>		m_strokeStamps;
+	uint32_t					m_strokeStamp; //0 outside of a translucent stroke
+	uint32_t					m_strokeCount;
 
 	//view port
 	float						m_cx, m_cy, m_span;
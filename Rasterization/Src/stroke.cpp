@@ -0,0 +1,177 @@
+#include "stroke.h"
+#include "svg.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static const double PI = 3.14159265358979323846;
+static const double EPSILON = 0.0000000001;
+
+namespace CGCore
+{
+
+/* Left normal of the direction d*/
+static inline Vector2D normal(const Vector2D& d)
+{
+	return Vector2D(-d.y, d.x);
+}
+
+static inline void pushTriangle(vector<Vector2D>& triangles, const Vector2D& a, const Vector2D& b, const Vector2D& c)
+{
+	triangles.push_back(a);
+	triangles.push_back(b);
+	triangles.push_back(c);
+}
+
+/* Quad a b c d, the vertices in order around it*/
+static inline void pushQuad(vector<Vector2D>& triangles, const Vector2D& a, const Vector2D& b, const Vector2D& c, const Vector2D& d)
+{
+	pushTriangle(triangles, a, b, c);
+	pushTriangle(triangles, a, c, d);
+}
+
+/* Angle between the points of an arc of the given radius, so that its chords stay within tolerance of it*/
+static double arcStep(double radius, double tolerance)
+{
+	if (tolerance >= radius) return PI / 2.;
+	return max(2. * acos(1. - tolerance / radius), PI / 256.);
+}
+
+/* Fan of triangles around center, over the arc starting at center + from and sweeping the angle sweep*/
+static void pushArc(vector<Vector2D>& triangles, const Vector2D& center, const Vector2D& from, double sweep, double step)
+{
+	int n = max(1, (int)ceil(fabs(sweep) / step));
+	double c = cos(sweep / n), s = sin(sweep / n);
+	Vector2D p = from;
+	for (int i = 0; i < n; ++i)
+	{
+		Vector2D q(p.x * c - p.y * s, p.x * s + p.y * c);
+		pushTriangle(triangles, center, center + p, center + q);
+		p = q;
+	}
+}
+
+/*
+* Join at p between the segments of directions d0 and d1. The segment quads already cover the inner side,
+* the join fills the gap on the outer side.
+*/
+static void pushJoin(vector<Vector2D>& triangles, const Vector2D& p, const Vector2D& d0, const Vector2D& d1,
+					 const Style& style, double hw, double step)
+{
+	double sinTurn = cross(d0, d1), cosTurn = dot(d0, d1);
+	if (fabs(sinTurn) < EPSILON && cosTurn > 0.) return; //no turn
+
+	double side = sinTurn > 0. ? -1. : 1.; //the outer side
+	Vector2D n0 = normal(d0) * (side * hw), n1 = normal(d1) * (side * hw);
+
+	switch (style.lineJoin)
+	{
+	case JOIN_ROUND:
+		pushArc(triangles, p, n0, atan2(sinTurn, cosTurn), step);
+		return;
+	case JOIN_MITER:
+	{
+		//miter length / stroke width = 1 / sin(angle between the segments / 2)
+		double miterRatio = sqrt(2. / max(1. + cosTurn, EPSILON));
+		if (miterRatio <= style.miterLimit)
+		{
+			Vector2D tip = p + (n0 + n1).unit() * (hw * miterRatio);
+			pushTriangle(triangles, p, p + n0, tip);
+			pushTriangle(triangles, p, tip, p + n1);
+			return;
+		}
+		//Past the miter limit, the join is a bevel
+	}
+	default:
+		pushTriangle(triangles, p, p + n0, p + n1);
+		return;
+	}
+}
+
+/* Cap at the end point p of the line, d is the direction out of the line*/
+static void pushCap(vector<Vector2D>& triangles, const Vector2D& p, const Vector2D& d, const Style& style, double hw, double step)
+{
+	Vector2D n = normal(d) * hw;
+	switch (style.lineCap)
+	{
+	case CAP_ROUND:
+		pushArc(triangles, p, n, -PI, step);
+		break;
+	case CAP_SQUARE:
+	{
+		Vector2D e = d * hw;
+		pushQuad(triangles, p + n, p + n + e, p - n + e, p - n);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void strokePolyline(const float* x, const float* y, size_t count, bool closed, const Style& style,
+					float tolerance, vector<Vector2D>& triangles)
+{
+	triangles.clear();
+	double hw = style.strokeWidth / 2.;
+	if (!(hw > 0.)) return;
+	double step = arcStep(hw, tolerance);
+
+	//Repeated points have no direction, drop them
+	vector<Vector2D> p;
+	p.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		Vector2D point(x[i], y[i]);
+		if (p.empty() || (point - p.back()).norm2() > EPSILON) p.push_back(point);
+	}
+	if (closed && p.size() > 2 && (p.front() - p.back()).norm2() <= EPSILON) p.pop_back();
+	if (p.empty()) return;
+
+	if (p.size() == 1)
+	{
+		//Zero length path, only the round and square caps draw it
+		if (closed) return;
+		if (style.lineCap == CAP_ROUND)
+		{
+			pushArc(triangles, p[0], Vector2D(hw, 0.), 2. * PI, step);
+		}
+		else if (style.lineCap == CAP_SQUARE)
+		{
+			pushQuad(triangles, p[0] + Vector2D(-hw, -hw), p[0] + Vector2D(hw, -hw),
+								p[0] + Vector2D( hw,  hw), p[0] + Vector2D(-hw, hw));
+		}
+		return;
+	}
+
+	size_t nPoints = p.size();
+	size_t nSegments = closed ? nPoints : nPoints - 1;
+	vector<Vector2D> dirs(nSegments);
+	for (size_t i = 0; i < nSegments; ++i)
+	{
+		const Vector2D &a = p[i], &b = p[(i + 1) % nPoints];
+		dirs[i] = (b - a).unit();
+		Vector2D n = normal(dirs[i]) * hw;
+		pushQuad(triangles, a + n, b + n, b - n, a - n);
+	}
+
+	if (closed)
+	{
+		for (size_t i = 0; i < nPoints; ++i)
+		{
+			pushJoin(triangles, p[i], dirs[(i + nSegments - 1) % nSegments], dirs[i], style, hw, step);
+		}
+	}
+	else
+	{
+		for (size_t i = 1; i + 1 < nPoints; ++i)
+		{
+			pushJoin(triangles, p[i], dirs[i - 1], dirs[i], style, hw, step);
+		}
+		pushCap(triangles, p[0], -dirs[0], style, hw, step);
+		pushCap(triangles, p[nPoints - 1], dirs[nSegments - 1], style, hw, step);
+	}
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef STROKE_H
+#define STROKE_H
+
+#include "vector2D.h"
+
+#include <vector>
+
+namespace CGCore
+{
+
+struct Style;
+
+/*
+* Expand the stroke of the polyline (x, y)[0, count) into a triangle list, in the space of the points.
+* Joins, caps, width and miter limit come from the style. Round joins and caps are tessellated so that
+* the chords stay within tolerance of the arcs.
+*/
+void strokePolyline(const float* x, const float* y, size_t count, bool closed, const Style& style,
+					float tolerance, std::vector<Vector2D>& triangles);
+
+/*
+* Tessellated stroke of an element, valid for one zoom bucket.
+* The tessellation depends on the zoom only through the density of the round joins and caps.
+*/
+struct StrokeMesh
+{
+	int					  zoomBucket;
+	std::vector<Vector2D> triangles; //in the element space
+};
+
+}
+
+#endif
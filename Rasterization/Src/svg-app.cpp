@@ -103,6 +103,46 @@ void AppSVG::keyboard_event(int key, int event, unsigned char mods)
 	case 'Z':
 		m_drawZoom = !m_drawZoom;
 		break;
+	case 'L':
+		//Switch the MLAA edge detection between RGB and luma
+		if (m_renderer->mlaaEdgeDetection() == MLAntialias::DETECT_LUMA)
+			m_renderer->setMLAAEdgeDetection(MLAntialias::DETECT_RGB, MLAntialias::kRGBThreshold);
+		else
+			m_renderer->setMLAAEdgeDetection(MLAntialias::DETECT_LUMA, MLAntialias::kLumaThreshold);
+		m_renderer->redraw();
+		break;
+	case 'A':
+		//Cycle through the antialiasing modes
+		m_renderer->setAAMode((SoftwareRenderer::AAMode)((m_renderer->aaMode() + 1) % SoftwareRenderer::AA_MODE_COUNT));
+		out_msg("Antialiasing: " << SoftwareRenderer::aaModeName(m_renderer->aaMode()));
+		m_renderer->redraw();
+		break;
+	case 'T':
+		m_renderer->setTimingReport(!m_renderer->timingReport());
+		break;
+	case 'W':
+		//Thin strokes as Wu lines or aliased lines, when MLAA is off
+		m_renderer->setWuLines(!m_renderer->wuLines());
+		m_renderer->redraw();
+		break;
+	case 'S':
+	{
+		//Save the current frame to the working directory
+		char filename[32];
+		sprintf(filename, "tab%d.png", (int)m_curTab);
+		if (m_renderer->saveFramebuffer(filename) == 0) out_msg("Saved " << filename);
+		else out_err("Failed to save " << filename);
+		break;
+	}
+	case 'Q':
+	{
+		//Quick QOI dump of the current frame, for diffing
+		char filename[32];
+		sprintf(filename, "tab%d.qoi", (int)m_curTab);
+		if (m_renderer->saveFramebuffer(filename, SnapshotWriter::FORMAT_QOI) == 0) out_msg("Saved " << filename);
+		else out_err("Failed to save " << filename);
+		break;
+	}
 	default:
 		break;
 	}
@@ -1,111 +1,345 @@
 #include "svg.h"
 #include "console.h"
-#include "tinyxml2.h"
+#include "xml-tokenizer.h"
 #include "misc.h"
-#include "png.h"
+#include "texture-cache.h"
+#include "thread-pool.h"
+#include "mapped-file.h"
 
-#include <sstream>
-#include <algorithm>
+#include <map>
+#include <deque>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
 
 using namespace std;
-using namespace tinyxml2;
 
 namespace CGCore
 {
 
 void SVGParser::load(const char* filename, SVG* svg)
 {
+	//The elements are built as the mapped file is read, no document tree is kept
+	MappedFile file(filename);
+	if (!file.isOpen())
+	{
+		out_err("Can't open " << filename);
+		exit(1);
+	}
 
-	XMLDocument doc;
-	doc.LoadFile(filename);
-	if (doc.Error())
+	XMLTokenizer xml((const char*)file.data(), file.size());
+	if (xml.next() != XMLTokenizer::TOKEN_START || !xml.nameIs("svg"))
 	{
-		doc.PrintError();
+		if (xml.error()) out_err(filename << ":" << xml.errorLine() << ": " << xml.error());
+		else			 out_err("Not an SVG file");
 		exit(1);
 	}
 
-	XMLElement* root = doc.FirstChildElement("svg");
-	if (!root)
+	svg->width = xml.floatAttribute("width");
+	svg->height = xml.floatAttribute("height");
+
+	if (!parseSVG(xml, svg, filename)) exit(1);
+	loadImages(svg);
+}
+
+struct SVGParser::Builder
+{
+	Builder(Arena& _arena, vector<float>& _x, vector<float>& _y) : arena(_arena), x(_x), y(_y) {}
+
+	/* Append (px, py) to the pools and to the coordinates of element*/
+	void add(SVGElement* element, float px, float py)
 	{
-		out_err("Not an SVG file");
+		if (element->count++ == 0) element->first = (uint32_t)x.size();
+		x.push_back(px);
+		y.push_back(py);
 	}
 
-	string wcstr = root->Attribute("width");
-	string hcstr = root->Attribute("height");
+	Arena&					 arena;
+	vector<float>&			 x;		   //coordinate pools of the elements
+	vector<float>&			 y;
+	vector<SVGElement*>		 elements; //children of the open elements, moved to the arena as each one ends
+};
 
-	
-	svg->width = stof(wcstr);
-	svg->height = stof(hcstr);
+/* Top level elements parsed by one task, with the arena they are allocated from and their coordinates*/
+struct SVGBatch
+{
+	SVGBatch() : begin(NULL), end(NULL), error(NULL), errorLine(0) {}
+
+	const char*				begin; //text of the elements
+	const char*				end;
+	Arena					arena;
+	vector<float>			x;
+	vector<float>			y;
+	ArenaArray<SVGElement*>	elements;
+	const char*				error;
+	int						errorLine;
+};
+
+static const size_t kBatchText = 256 << 10;
+
+/* Move the coordinates of elements and of their children by offset, once their batch is appended to the pools*/
+static void rebase(const ArenaArray<SVGElement*>& elements, uint32_t offset)
+{
+	for (SVGElement* element : elements)
+	{
+		if (element->type == GROUP) rebase(static_cast<Group*>(element)->elements, offset);
+		else						element->first += offset;
+	}
+}
+
+/*
+* The top level elements, usually the layers of a drawing, are found by a pass reading only the structure of
+* the document. They are parsed on the thread pool in batches of about kBatchText bytes of text, each batch
+* with its own tokenizer, arena and coordinate pools, while the pass goes on. The batches are then spliced back
+* in document order, so the elements are the same as when read in one go. With a single thread they are read
+* in one go.
+*/
+bool SVGParser::parseSVG(XMLTokenizer& xml, SVG* svg, const char* filename)
+{
+	if (ThreadPool::instance().concurrency() == 1)
+	{
+		Builder builder(svg->arena, svg->x, svg->y);
+		parseChildren(xml, builder, svg->elements);
+		if (xml.error())
+		{
+			out_err(filename << ":" << xml.errorLine() << ": " << xml.error());
+			return false;
+		}
+		return true;
+	}
+
+	deque<SVGBatch> batches;
+	TaskGroup tasks;
+	const char* text = xml.text();
+	auto submit = [&](const char* begin, const char* end)
+	{
+		batches.emplace_back();
+		SVGBatch* batch = &batches.back();
+		batch->begin = begin;
+		batch->end = end;
+		tasks.run([text, batch]()
+		{
+			XMLTokenizer batchXML(text, batch->begin, batch->end);
+			Builder builder(batch->arena, batch->x, batch->y);
+			parseChildren(batchXML, builder, batch->elements);
+			if (batchXML.error())
+			{
+				batch->error = batchXML.error();
+				batch->errorLine = batchXML.errorLine();
+			}
+		});
+	};
+
+	const char* begin = NULL;
+	const char* end = NULL;
+	xml.setStructureOnly(true);
+	while (xml.next() == XMLTokenizer::TOKEN_START)
+	{
+		if (!begin) begin = xml.tagBegin();
+		if (xml.skipElement() != XMLTokenizer::TOKEN_END) break;
+		end = xml.position();
+		if ((size_t)(end - begin) >= kBatchText)
+		{
+			submit(begin, end);
+			begin = NULL;
+		}
+	}
+	if (begin && !xml.error()) submit(begin, end);
+	xml.setStructureOnly(false);
+	tasks.wait();
+
+	//The batches come before the point where the structure pass stopped
+	for (SVGBatch& batch : batches)
+	{
+		if (batch.error)
+		{
+			out_err(filename << ":" << batch.errorLine << ": " << batch.error);
+			return false;
+		}
+	}
+	if (xml.error())
+	{
+		out_err(filename << ":" << xml.errorLine() << ": " << xml.error());
+		return false;
+	}
 
-	parseSVG(root, svg);
+	size_t coordinates = 0;
+	for (SVGBatch& batch : batches) coordinates += batch.x.size();
+	svg->x.reserve(coordinates);
+	svg->y.reserve(coordinates);
+
+	vector<SVGElement*> elements;
+	for (SVGBatch& batch : batches)
+	{
+		rebase(batch.elements, (uint32_t)svg->x.size());
+		svg->x.insert(svg->x.end(), batch.x.begin(), batch.x.end());
+		svg->y.insert(svg->y.end(), batch.y.begin(), batch.y.end());
+		vector<float>().swap(batch.x);
+		vector<float>().swap(batch.y);
+		elements.insert(elements.end(), batch.elements.begin(), batch.elements.end());
+		svg->arena.merge(batch.arena);
+	}
+	svg->elements.assign(svg->arena, elements.data(), elements.size());
+	return true;
 }
 
-void SVGParser::parseSVG(XMLElement* xml, SVG* svg)
+void SVGParser::parseChildren(XMLTokenizer& xml, Builder& builder, ArenaArray<SVGElement*>& elements)
 {
-	XMLElement* elem = xml->FirstChildElement();
-	while (elem)
+	Arena& arena = builder.arena;
+	size_t first = builder.elements.size();
+	while (xml.next() == XMLTokenizer::TOKEN_START)
 	{
-		string elementType(elem->Value());
-		
-		if (elementType == "line") 
+		if (xml.nameIs("line")) 
 		{
-			Line* line = new Line();
-			parseLine(elem, line);
-			svg->elements.push_back(line);
+			Line* line = arena.create<Line>();
+			parseLine(xml, builder, line);
+			builder.elements.push_back(line);
 		}
-		else if (elementType == "polygon")
+		else if (xml.nameIs("polygon"))
 		{
-			Polygon *polygon = new Polygon();
-			parsePolygon(elem, polygon);
-			svg->elements.push_back(polygon);
+			Polygon *polygon = arena.create<Polygon>();
+			parsePolygon(xml, builder, polygon);
+			builder.elements.push_back(polygon);
 		} 
-		else if (elementType == "g")
+		else if (xml.nameIs("g"))
 		{
-			Group *group = new Group();
-			parseGroup(elem, group);
-			svg->elements.push_back(group);
+			//reads up to the end of the group
+			Group *group = arena.create<Group>();
+			parseGroup(xml, builder, group);
+			builder.elements.push_back(group);
+			continue;
 		}
-		else if (elementType == "rect")
+		else if (xml.nameIs("rect"))
 		{
-			float w = elem->FloatAttribute("width");
-			float h = elem->FloatAttribute("height");
+			float w = xml.floatAttribute("width");
+			float h = xml.floatAttribute("height");
 			// treat zero-size rectangles as points
 			if (w == 0 && h == 0) {
-				Point* point = new Point();
-				parsePoint(elem, point);
-				svg->elements.push_back(point);
+				Point* point = arena.create<Point>();
+				parsePoint(xml, builder, point);
+				builder.elements.push_back(point);
 			}
 			else {
-				Rect* rect = new Rect();
-				parseRect(elem, rect);
-				svg->elements.push_back(rect);
+				Rect* rect = arena.create<Rect>();
+				parseRect(xml, builder, rect);
+				builder.elements.push_back(rect);
 			}
 		}
-		else if (elementType == "image")
+		else if (xml.nameIs("image"))
 		{
-			Image *image = new Image();
-			parseImage(elem, image);
-			svg->elements.push_back(image);
+			Image *image = arena.create<Image>();
+			parseImage(xml, builder, image);
+			builder.elements.push_back(image);
 		}
 
-		elem = elem->NextSiblingElement();
+		//the content of the element, unknown elements and their children are ignored
+		if (xml.skipElement() != XMLTokenizer::TOKEN_END) break;
 	}
+
+	elements.assign(arena, builder.elements.data() + first, builder.elements.size() - first);
+	builder.elements.resize(first);
 }
 
 
-void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
+/*
+* SVG numbers, read in place from the attribute text without allocating. Numbers in a list are separated by
+* white space and at most one comma, or by nothing when a number can't go on, as in "1-2" or ".5.5".
+*/
+static const double kPow10[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+								   1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skipSeparator(const char* p)
+{
+	while (isSpace(*p)) ++p;
+	if (*p == ',')
+	{
+		++p;
+		while (isSpace(*p)) ++p;
+	}
+	return p;
+}
+
+/* Read the number after the separator at p and move p past it. Returns false, p unchanged, if there is none.*/
+static bool scanNumber(const char*& p, float& value)
+{
+	const char* s = skipSeparator(p);
+	const char* start = s;
+	bool negative = false;
+	if (*s == '+' || *s == '-') negative = *s++ == '-';
+
+	//up to 19 significant digits in the mantissa, the others only move the exponent
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; isDigit(*s); ++s, any = true)
+	{
+		if (digits < 19) { mantissa = mantissa * 10 + (*s - '0'); if (mantissa) ++digits; }
+		else ++exponent;
+	}
+	if (*s == '.')
+	{
+		for (++s; isDigit(*s); ++s, any = true)
+		{
+			if (digits < 19) { mantissa = mantissa * 10 + (*s - '0'); if (mantissa) ++digits; --exponent; }
+		}
+	}
+	if (!any) return false;
+
+	//an exponent only if digits follow, 1em is 1 then em
+	if (*s == 'e' || *s == 'E')
+	{
+		const char* e = s + 1;
+		bool negativeExponent = false;
+		if (*e == '+' || *e == '-') negativeExponent = *e++ == '-';
+		if (isDigit(*e))
+		{
+			int n = 0;
+			for (; isDigit(*e); ++e) if (n < 10000) n = n * 10 + (*e - '0');
+			exponent += negativeExponent ? -n : n;
+			s = e;
+		}
+	}
+
+	//exact in double when the mantissa and the power of ten are, which is almost always the case
+	double result;
+	if (mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+		result = exponent < 0 ? mantissa / kPow10[-exponent] : mantissa * kPow10[exponent];
+	else
+		result = fabs(strtod(start, NULL));
+	value = (float)(negative ? -result : result);
+	p = s;
+	return true;
+}
+
+static inline bool isType(const char* type, size_t length, const char* name)
+{
+	return strlen(name) == length && memcmp(type, name, length) == 0;
+}
+
+void SVGParser::parseElement(XMLTokenizer& xml, SVGElement* element)
 {
 	//Parse style
 	Style* style = &element->style;
 	//fillColor
-	const char* fill = xml->Attribute("fill");
+	const char* fill = xml.attribute("fill");
 	if (fill) style->fillColor = Color::fromHex(fill);
-	const char* fill_opacity = xml->Attribute("fill-opacity");
+	const char* fill_opacity = xml.attribute("fill-opacity");
 	if (fill_opacity) style->fillColor.a = atof(fill_opacity);
 
 	//Stroke
-	const char* stroke = xml->Attribute("stroke");
-	const char* stroke_opacity = xml->Attribute("stroke-opacity");
+	const char* stroke = xml.attribute("stroke");
+	const char* stroke_opacity = xml.attribute("stroke-opacity");
 	if (stroke) {
 		style->strokeColor = Color::fromHex(stroke);
 		if (stroke_opacity) style->strokeColor.a = atof(stroke_opacity);
@@ -114,11 +348,25 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 		style->strokeColor = Color::Black;
 		style->strokeColor.a = 0;
 	}
-	xml->QueryFloatAttribute("stroke-width", &style->strokeWidth);
-	xml->QueryFloatAttribute("stroke-miterlimit", &style->miterLimit);
+	xml.queryFloatAttribute("stroke-width", &style->strokeWidth);
+	xml.queryFloatAttribute("stroke-miterlimit", &style->miterLimit);
+	const char* linejoin = xml.attribute("stroke-linejoin");
+	if (linejoin) {
+		string join = linejoin;
+		if (join == "round")	  style->lineJoin = JOIN_ROUND;
+		else if (join == "bevel") style->lineJoin = JOIN_BEVEL;
+		else					  style->lineJoin = JOIN_MITER;
+	}
+	const char* linecap = xml.attribute("stroke-linecap");
+	if (linecap) {
+		string cap = linecap;
+		if (cap == "round")		  style->lineCap = CAP_ROUND;
+		else if (cap == "square") style->lineCap = CAP_SQUARE;
+		else					  style->lineCap = CAP_BUTT;
+	}
 
 	//Parse transformation
-	const char* trans = xml->Attribute("transform");
+	const char* trans = xml.attribute("transform");
 	if (trans) {
 
 		// NOTE (sky):
@@ -129,23 +377,29 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 
 		Matrix3x3 transform = Matrix3x3::identity();
 
-		string trans_str = trans; size_t paren_l, paren_r;
-		while (trans_str.find_first_of('(') != string::npos) {
+		const char* p = trans;
+		for (;;) {
 
-			paren_l = trans_str.find_first_of('(');
-			paren_r = trans_str.find_first_of(')');
+			// name(numbers), the list is read in place
+			p = skipSeparator(p);
+			const char* type = p;
+			while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')) ++p;
+			size_t typeLength = p - type;
+			while (isSpace(*p)) ++p;
+			if (typeLength == 0 || *p != '(') break;
+			++p;
 
-			string type = trans_str.substr(0, paren_l);
-			string data = trans_str.substr(paren_l + 1, paren_r - paren_l - 1);
+			float data[6];
+			int count = 0;
+			while (count < 6 && scanNumber(p, data[count])) ++count;
+			while (isSpace(*p)) ++p;
+			if (*p != ')') break; // malformed, the rest of the list is ignored
+			++p;
 
-			if (type == "matrix") {
+			if (isType(type, typeLength, "matrix")) {
 
-				string matrix_str = data;
-				replace(matrix_str.begin(), matrix_str.end(), ',', ' ');
-
-				stringstream ss(matrix_str);
-				float a; float b; float c; float d; float e; float f;
-				ss >> a; ss >> b; ss >> c; ss >> d; ss >> e; ss >> f;
+				if (count < 6) continue;
+				float a = data[0]; float b = data[1]; float c = data[2]; float d = data[3]; float e = data[4]; float f = data[5];
 
 				Matrix3x3 m;
 				m(0, 0) = a; m(0, 1) = c; m(0, 2) = e;
@@ -154,11 +408,10 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 				transform = transform * m;
 
 			}
-			else if (type == "translate") {
+			else if (isType(type, typeLength, "translate")) {
 
-				stringstream ss(data);
-				float x; if (!(ss >> x)) x = 0;
-				float y; if (!(ss >> y)) y = 0;
+				float x = count > 0 ? data[0] : 0;
+				float y = count > 1 ? data[1] : 0;
 
 				Matrix3x3 m = Matrix3x3::identity();
 
@@ -168,11 +421,11 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 				transform = transform * m;
 
 			}
-			else if (type == "scale") {
+			else if (isType(type, typeLength, "scale")) {
 
-				stringstream ss(data);
-				float x; if (!(ss >> x)) x = 1;
-				float y; if (!(ss >> y)) y = 1;
+				// scale(x) scales y by x too
+				float x = count > 0 ? data[0] : 1;
+				float y = count > 1 ? data[1] : x;
 
 				Matrix3x3 m = Matrix3x3::identity();
 
@@ -182,12 +435,11 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 				transform = transform * m;
 
 			}
-			else if (type == "rotate") {
+			else if (isType(type, typeLength, "rotate")) {
 
-				stringstream ss(data);
-				float a; if (!(ss >> a)) a = 0;
-				float x; if (!(ss >> x)) x = 0;
-				float y; if (!(ss >> y)) y = 0;
+				float a = count > 0 ? data[0] : 0;
+				float x = count > 1 ? data[1] : 0;
+				float y = count > 2 ? data[2] : 0;
 
 				if (x != 0 || y != 0) {
 
@@ -213,10 +465,9 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 				}
 
 			}
-			else if (type == "skewX") {
+			else if (isType(type, typeLength, "skewX")) {
 
-				stringstream ss(data);
-				float a; ss >> a;
+				float a = count > 0 ? data[0] : 0;
 
 				Matrix3x3 m = Matrix3x3::identity();
 
@@ -225,10 +476,9 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 				transform = transform * m;
 
 			}
-			else if (type == "skewY") {
+			else if (isType(type, typeLength, "skewY")) {
 
-				stringstream ss(data);
-				float a; ss >> a;
+				float a = count > 0 ? data[0] : 0;
 
 				Matrix3x3 m = Matrix3x3::identity();
 
@@ -238,11 +488,9 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 
 			}
 			else {
-				cerr << "unknown transformation type: " << type << endl;
+				cerr << "unknown transformation type: " << string(type, typeLength) << endl;
 			}
 
-			size_t end = paren_r + 2;
-			trans_str.erase(0, end);
 		}
 
 		element->transform = transform;
@@ -250,132 +498,104 @@ void SVGParser::parseElement(XMLElement* xml, SVGElement* element)
 
 }
 
-void SVGParser::parsePoint(XMLElement* xml, Point* point) {
+void SVGParser::parsePoint(XMLTokenizer& xml, Builder& builder, Point* point) {
 	parseElement(xml, point);
-	point->position = Vector2D(xml->FloatAttribute("x"),
-		xml->FloatAttribute("y"));
+	builder.add(point, xml.floatAttribute("x"), xml.floatAttribute("y"));
 }
 
-void SVGParser::parseLine(XMLElement* xml, Line*  line)
+void SVGParser::parseLine(XMLTokenizer& xml, Builder& builder, Line*  line)
 {
 	parseElement(xml, line);
 
-	line->from = Vector2D(xml->FloatAttribute("x1"), xml->FloatAttribute("y1"));
-	line->to   = Vector2D(xml->FloatAttribute("x2"), xml->FloatAttribute("y2"));
+	builder.add(line, xml.floatAttribute("x1"), xml.floatAttribute("y1"));
+	builder.add(line, xml.floatAttribute("x2"), xml.floatAttribute("y2"));
 }
 
-void SVGParser::parsePolygon(XMLElement* xml, Polygon*  polygon)
+void SVGParser::parsePolygon(XMLTokenizer& xml, Builder& builder, Polygon*  polygon)
 {
 	parseElement(xml, polygon);
 
-	stringstream points(xml->Attribute("points"));
+	const char* points = xml.attribute("points");
+	if (!points) return;
 	float x, y;
-	char c;
-	while (points >> x >> c >> y) {
-		polygon->points.push_back(Vector2D(x, y));
+	while (scanNumber(points, x) && scanNumber(points, y)) {
+		builder.add(polygon, x, y);
 	}
 }
 
-void SVGParser::parseGroup(XMLElement* xml, Group*  group)
+void SVGParser::parseGroup(XMLTokenizer& xml, Builder& builder, Group*  group)
 {
-
 	parseElement(xml, group);
-	XMLElement* elem = xml->FirstChildElement();
-	while (elem)
-	{
-		string elementType(elem->Value());
-
-		if (elementType == "line")
-		{
-			Line* line = new Line();
-			parseLine(elem, line);
-			group->elements.push_back(line);
-		}
-		else if (elementType == "polygon")
-		{
-			Polygon *polygon = new Polygon();
-			parsePolygon(elem, polygon);
-			group->elements.push_back(polygon);
-		}
-		else if (elementType == "g")
-		{
-			Group * group = new Group();
-			parseGroup(elem, group);
-			group->elements.push_back(group);
-		}
-		else if (elementType == "rect")
-		{
-			float w = elem->FloatAttribute("width");
-			float h = elem->FloatAttribute("height");
-			// treat zero-size rectangles as points
-			if (w == 0 && h == 0) {
-				Point* point = new Point();
-				parsePoint(elem, point);
-				group->elements.push_back(point);
-			}
-			else {
-				Rect* rect = new Rect();
-				parseRect(elem, rect);
-				group->elements.push_back(rect);
-			}
-		}
-
-		elem = elem->NextSiblingElement();
-	}
+	parseChildren(xml, builder, group->elements);
 }
 
-void SVGParser::parseRect(XMLElement* xml, Rect* rect)
+void SVGParser::parseRect(XMLTokenizer& xml, Builder& builder, Rect* rect)
 {
 	parseElement(xml, rect);
 
-	rect->position = Vector2D(xml->FloatAttribute("x"),
-		xml->FloatAttribute("y"));
-	rect->dimension = Vector2D(xml->FloatAttribute("width"),
-		xml->FloatAttribute("height"));
+	builder.add(rect, xml.floatAttribute("x"),	   xml.floatAttribute("y"));
+	builder.add(rect, xml.floatAttribute("width"), xml.floatAttribute("height"));
 }
 
-void SVGParser::parseImage(XMLElement* xml, Image* image)
+void SVGParser::parseImage(XMLTokenizer& xml, Builder& builder, Image* image)
 {
 	parseElement(xml, image);
 
-	image->position = Vector2D(	xml->FloatAttribute("x"),
-								xml->FloatAttribute("y"));
-	image->dimension = Vector2D(xml->FloatAttribute("width"),
-								xml->FloatAttribute("height"));
+	builder.add(image, xml.floatAttribute("x"),		xml.floatAttribute("y"));
+	builder.add(image, xml.floatAttribute("width"), xml.floatAttribute("height"));
 
-	const char* file = xml->Attribute("xlink:href");
-	PNG png; PNGParser::load(file, png);
-	
-	MipLevel mip0;
-	mip0.width = png.width;
-	mip0.height = png.height;
-	mip0.texels = png.pixels;
-
-	image->tex.width = mip0.width;
-	image->tex.height = mip0.height;
-	image->tex.generateMips(mip0);
+	//Decoded by loadImages once the document is parsed
+	const char* file = xml.attribute("xlink:href");
+	if (file) image->href = file;
 	return;
 }
 
-void SVGParser::save(const char* filename, const SVG* svg)
+/* Images of the elements and their groups, by file*/
+static void collectImages(const ArenaArray<SVGElement*>& elements, map<string, vector<Image*> >& files)
 {
-	
+	for (SVGElement *pe : elements)
+	{
+		if (pe->type == IMAGE)
+		{
+			Image* image = static_cast<Image*>(pe);
+			if (!image->href.empty()) files[image->href].push_back(image);
+		}
+		else if (pe->type == GROUP)
+		{
+			collectImages(static_cast<Group*>(pe)->elements, files);
+		}
+	}
 }
 
-Group::~Group()
+/*
+* Decode the images of the document in parallel, one task per distinct file, and wait for them so that
+* the document is complete when load returns. Files already in the TextureCache are not decoded again.
+*/
+void SVGParser::loadImages(SVG* svg)
 {
-	for each (SVGElement *pe in elements)
+	map<string, vector<Image*> > files;
+	collectImages(svg->elements, files);
+
+	//The cache is created on this thread, VS2013 doesn't make the initialization of local statics thread safe
+	TextureCache* cache = &TextureCache::instance();
+
+	TaskGroup tasks;
+	for (map<string, vector<Image*> >::iterator it = files.begin(); it != files.end(); ++it)
 	{
-		delete pe;
+		const string* file = &it->first;
+		vector<Image*>* images = &it->second;
+		tasks.run([cache, file, images]()
+		{
+			shared_ptr<const Texture> tex = cache->load(file->c_str());
+			for each (Image *image in *images) image->tex = tex;
+		});
 	}
+	tasks.wait();
 }
 
-SVG::~SVG()
+void SVGParser::save(const char* filename, const SVG* svg)
 {
-	for each (SVGElement *pe in elements)
-	{
-		delete pe;
-	}
+	
 }
 
 }
\ No newline at end of file
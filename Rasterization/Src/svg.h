@@ -3,14 +3,19 @@
 
 #include "color.h"
 #include "matrix3x3.h"
-#include "tinyxml2.h"
 #include "texture.h"
+#include "arena.h"
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
 
 namespace CGCore
 {
 
+class XMLTokenizer;
+
 typedef enum e_SVGElementType
 {
 	NONE = 0,
@@ -24,72 +29,93 @@ typedef enum e_SVGElementType
 	GROUP,
 }SVGELementType;
 
+typedef enum e_LineJoin
+{
+	JOIN_MITER = 0,
+	JOIN_ROUND,
+	JOIN_BEVEL,
+}LineJoin;
+
+typedef enum e_LineCap
+{
+	CAP_BUTT = 0,
+	CAP_ROUND,
+	CAP_SQUARE,
+}LineCap;
+
+/*Defaults are the SVG initial values*/
 struct Style {
+
+	Style() : strokeWidth(1.f), miterLimit(4.f), lineJoin(JOIN_MITER), lineCap(CAP_BUTT) {}
+
 	Color strokeColor;
 	Color fillColor;
 	float strokeWidth;
 	float miterLimit;
+	LineJoin lineJoin;
+	LineCap lineCap;
 };
 
+/*
+* The coordinates of the drawn elements are kept in the pools x and y of their SVG, in document order.
+* Each element holds its range of the pools:
+* POINT	   position
+* LINE	   from, to
+* RECT	   position, dimension
+* POLYGON  and POLYLINE, the points
+* IMAGE	   position, dimension
+*/
 struct SVGElement
 {
 
 	SVGElement(SVGELementType _type)
-		: type(_type), transform(Matrix3x3::identity())
+		: type(_type), transform(Matrix3x3::identity()), first(0), count(0)
 	{}
 
-	virtual ~SVGElement() {}
-
 	SVGELementType type;
 	/*Common element for all SVGElement*/
 	//Style
 	Style style;
 	//Transformation list
 	Matrix3x3 transform;
+	//Coordinates [first, first + count) of SVG::x and SVG::y
+	uint32_t first;
+	uint32_t count;
 };
 
 struct Group : SVGElement {
 
 	Group() : SVGElement(GROUP) { }
-	std::vector<SVGElement*> elements;
-
-	~Group();
+	ArenaArray<SVGElement*> elements;
 };
 
 struct Point : SVGElement{
 
 	Point() : SVGElement(POINT) { }
-	Vector2D position;
 
 };
 
 struct Line : SVGElement {
 
 	Line() : SVGElement(LINE) { }
-	Vector2D from;
-	Vector2D to;
 
 };
 
 struct Polyline : SVGElement {
 
 	Polyline() : SVGElement(POLYLINE) { }
-	std::vector<Vector2D> points;
 
 };
 
 struct Rect : SVGElement {
 
 	Rect() : SVGElement(RECT) { }
-	Vector2D position;
-	Vector2D dimension;
 
 };
 
 struct Polygon : SVGElement {
 
 	Polygon() : SVGElement(POLYGON) { }
-	std::vector<Vector2D> points;
 
 };
 
@@ -104,16 +130,22 @@ struct Ellipse : SVGElement {
 struct Image : SVGElement {
 
 	Image() : SVGElement(IMAGE) { }
-	Vector2D position;
-	Vector2D dimension;
-	Texture tex;
+	std::string href;
+	std::shared_ptr<const Texture> tex; //shared through the TextureCache, NULL if the file can't be read
 };
 
+/*
+* The elements of a document are allocated from its arena, in the order they are read, and released with it.
+* Elements are never deleted one by one. Their coordinates are stored once, in the two pools x and y, which
+* the renderer reads in place.
+*/
 struct SVG {
 
-	~SVG();
 	float width, height;
-	std::vector<SVGElement*> elements;
+	ArenaArray<SVGElement*> elements;
+	Arena arena;
+	std::vector<float> x;
+	std::vector<float> y;
 
 };
 
@@ -125,21 +157,30 @@ public:
 
 private:
 
-	// parse a svg file
-	static void parseSVG(tinyxml2::XMLElement* xml, SVG* svg);
+	// parse the content of the svg element, false with the error reported if the document is malformed
+	static bool parseSVG(XMLTokenizer& xml, SVG* svg, const char* filename);
+
+	// the arena and coordinate pools of the document being parsed, and lists reused by all its elements
+	struct Builder;
+
+	// parse the child elements of the last start tag, up to its end tag
+	static void parseChildren(XMLTokenizer& xml, Builder& builder, ArenaArray<SVGElement*>& elements);
 
 	// parse shared properties of svg elements
-	static void parseElement(tinyxml2::XMLElement* xml, SVGElement* element);
+	static void parseElement(XMLTokenizer& xml, SVGElement* element);
 
 	// parse type specific properties
-	static void parsePoint(tinyxml2::XMLElement* xml, Point*  point);
-	static void parseLine(tinyxml2::XMLElement* xml, Line*  line);
-	static void parsePolyline(tinyxml2::XMLElement* xml, Polyline* polyline);
-	static void parseRect(tinyxml2::XMLElement* xml, Rect*   rect);
-	static void parsePolygon(tinyxml2::XMLElement* xml, Polygon*  polygon);
-	static void parseEllipse(tinyxml2::XMLElement* xml, Ellipse*  ellipse);
-	static void parseImage(tinyxml2::XMLElement* xml, Image*  image);
-	static void parseGroup(tinyxml2::XMLElement* xml, Group*    group);
+	static void parsePoint(XMLTokenizer& xml, Builder& builder, Point*  point);
+	static void parseLine(XMLTokenizer& xml, Builder& builder, Line*  line);
+	static void parsePolyline(XMLTokenizer& xml, Builder& builder, Polyline* polyline);
+	static void parseRect(XMLTokenizer& xml, Builder& builder, Rect*   rect);
+	static void parsePolygon(XMLTokenizer& xml, Builder& builder, Polygon*  polygon);
+	static void parseEllipse(XMLTokenizer& xml, Ellipse*  ellipse);
+	static void parseImage(XMLTokenizer& xml, Builder& builder, Image*  image);
+	static void parseGroup(XMLTokenizer& xml, Builder& builder, Group*    group);
+
+	// decode the images referenced by the parsed document
+	static void loadImages(SVG* svg);
 
 
 }; // class SVGParser
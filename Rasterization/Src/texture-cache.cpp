@@ -0,0 +1,209 @@
+#include "texture-cache.h"
+#include "png.h"
+#include "mapped-file.h"
+
+#include <vector>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace CGCore
+{
+
+static const size_t kDefaultBudget = 256 << 20;
+
+/* 64 bit FNV-1a*/
+static uint64_t hashBytes(const unsigned char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Dimensions of the image in the IHDR chunk, the first one of a png*/
+static bool pngSize(const unsigned char* data, size_t size, size_t& width, size_t& height)
+{
+	static const unsigned char kSignature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	if (size < 24 || memcmp(data, kSignature, 8) != 0 || memcmp(data + 12, "IHDR", 4) != 0) return false;
+	width  = ((size_t)data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+	height = ((size_t)data[20] << 24) | (data[21] << 16) | (data[22] << 8) | data[23];
+	return true;
+}
+
+static bool fileStat(const char* path, long long& size, time_t& mtime)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path, &st) != 0) return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0) return false;
+#endif
+	size = st.st_size;
+	mtime = st.st_mtime;
+	return true;
+}
+
+TextureCache& TextureCache::instance()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+TextureCache::TextureCache() : m_budget(kDefaultBudget)
+{
+}
+
+/* Called with the lock held. NULL unless the entry has the dimensions of the file, marks it as the most recently used*/
+shared_ptr<const Texture> TextureCache::find(const Content& content, size_t width, size_t height)
+{
+	unordered_map<Content, Entry, ContentHash>::iterator it = m_entries.find(content);
+	if (it == m_entries.end()) return shared_ptr<const Texture>();
+	const Texture& texture = *it->second.texture;
+	if (texture.width != width || texture.height != height) return shared_ptr<const Texture>();
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+	return it->second.texture;
+}
+
+
+shared_ptr<const Texture> TextureCache::load(const char* path)
+{
+	if (!path) return shared_ptr<const Texture>();
+
+	//1. Same path, unchanged file
+	long long size = 0;
+	time_t mtime = 0;
+	bool hasStat = fileStat(path, size, mtime);
+	if (hasStat)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		unordered_map<string, PathInfo>::iterator it = m_paths.find(path);
+		if (it != m_paths.end() && it->second.content.size == size && it->second.mtime == mtime)
+		{
+			shared_ptr<const Texture> texture = find(it->second.content, it->second.width, it->second.height);
+			if (texture) return texture;
+		}
+	}
+
+	//2. Same content, hashed from the mapped file and checked against the dimensions of its header
+	MappedFile file(path);
+	PathInfo info;
+	if (!file.isOpen() || !pngSize(file.data(), file.size(), info.width, info.height)) return shared_ptr<const Texture>();
+	info.content.hash = hashBytes(file.data(), file.size());
+	info.content.size = (long long)file.size();
+	info.mtime = mtime;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		shared_ptr<const Texture> texture = find(info.content, info.width, info.height);
+		if (texture)
+		{
+			if (hasStat) m_paths[path] = info;
+			return texture;
+		}
+	}
+
+	//3. Decode, out of the lock so that different images are decoded concurrently
+	PNG png;
+	if (PNGParser::load(file.data(), file.size(), png) != 0 || png.width <= 0 || png.height <= 0 ||
+		png.pixels.size() != 4 * (size_t)png.width * png.height)
+	{
+		return shared_ptr<const Texture>();
+	}
+	MipLevel mip0;
+	mip0.width = png.width;
+	mip0.height = png.height;
+	mip0.texels.swap(png.pixels);
+
+	shared_ptr<Texture> decoded = make_shared<Texture>();
+	decoded->width = mip0.width;
+	decoded->height = mip0.height;
+	decoded->generateMips(mip0);
+
+	info.width = decoded->width;
+	info.height = decoded->height;
+
+	lock_guard<mutex> lock(m_mutex);
+	shared_ptr<const Texture> texture = find(info.content, info.width, info.height);
+	if (texture) //decoded by another thread meanwhile
+	{
+		if (hasStat) m_paths[path] = info;
+		return texture;
+	}
+	//A different image with the same hash and size is cached, this one is not
+	if (m_entries.count(info.content)) return decoded;
+
+	Entry entry;
+	entry.texture = decoded;
+	m_lru.push_front(info.content);
+	entry.lru = m_lru.begin();
+	m_entries[info.content] = entry;
+	if (hasStat) m_paths[path] = info;
+	evict();
+	return decoded;
+}
+
+/* Called with the lock held, the bytes of the textures as allocated now*/
+size_t TextureCache::measure() const
+{
+	size_t total = 0;
+	for (unordered_map<Content, Entry, ContentHash>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		total += it->second.texture->bytes();
+	}
+	return total;
+}
+
+/*
+* Called with the lock held. Drop the least recently used textures no element holds, down to the budget.
+* Only the cache can build the levels of a texture no element holds, its size doesn't change meanwhile.
+*/
+void TextureCache::evict()
+{
+	size_t bytes = measure();
+	list<Content>::iterator it = m_lru.end();
+	while (bytes > m_budget && it != m_lru.begin())
+	{
+		--it;
+		Entry& entry = m_entries[*it];
+		if (entry.texture.use_count() > 1) continue;
+
+		bytes -= entry.texture->bytes();
+		m_entries.erase(*it);
+		it = m_lru.erase(it);
+	}
+}
+
+size_t TextureCache::budget() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_budget;
+}
+
+size_t TextureCache::bytes() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return measure();
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_budget = bytes;
+	evict();
+}
+
+void TextureCache::clear()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_entries.clear();
+	m_paths.clear();
+	m_lru.clear();
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "texture.h"
+
+#include <memory>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <ctime>
+
+namespace CGCore
+{
+
+/*
+* Process wide cache of decoded images, shared by all the elements and svg tabs referencing them.
+* Files are indexed by path, and by the hash and size of their content so that copies of an image at
+* different paths are decoded once too. A hit must also have the dimensions of the png header of the
+* file, a different image colliding with a cached one is decoded and not cached. A path is only read
+* again when its size or modification time changed.
+* Textures not referenced outside the cache are evicted, least recently used first, when the cache
+* holds more than its byte budget. Their sizes are measured when the cache evicts, the mip levels
+* built since they were loaded included.
+*/
+class TextureCache
+{
+public:
+	/* The process wide cache. Its first call must not race with another one, tasks get the cache from their caller.*/
+	static TextureCache& instance();
+
+	TextureCache();
+
+	/* The texture of the png file at path, decoded on the first load. NULL if it can't be read.*/
+	std::shared_ptr<const Texture> load(const char* path);
+
+	void   setBudget(size_t bytes);
+
+	size_t budget() const;
+
+	/* Bytes of the textures held by the cache, as allocated now*/
+	size_t bytes() const;
+
+	/* Drop the textures, the ones in use stay alive with their users*/
+	void   clear();
+
+private:
+	struct Content
+	{
+		uint64_t  hash;
+		long long size;
+
+		bool operator==(const Content& other) const { return hash == other.hash && size == other.size; }
+	};
+
+	struct ContentHash
+	{
+		size_t operator()(const Content& content) const { return (size_t)(content.hash ^ (uint64_t)content.size); }
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const Texture> texture;
+		std::list<Content>::iterator   lru;
+	};
+
+	struct PathInfo
+	{
+		Content content;
+		size_t	width;
+		size_t	height;
+		time_t	mtime;
+	};
+
+	std::shared_ptr<const Texture> find(const Content& content, size_t width, size_t height);
+	size_t measure() const;
+	void evict();
+
+	std::unordered_map<Content, Entry, ContentHash>	m_entries;
+	std::unordered_map<std::string, PathInfo>			m_paths;
+	std::list<Content>									m_lru;		//most recently used first
+	size_t												m_budget;
+	mutable std::mutex									m_mutex;
+};
+
+}
+
+#endif
@@ -1,39 +1,216 @@
 #include "texture.h"
 #include "color.h"
+#include "thread-pool.h"
 
 #include <algorithm>
 #include <vector>
 #include <cstdint>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 namespace CGCore
 {
 
-inline void uint8_to_float(float dst[4], unsigned char *src) 
+//Rows of a mip level built by one task, about this many texels
+static const size_t kMipBandTexels = 1 << 16;
+//Levels of at least this many texels are stored tiled
+static const size_t kTiledMinTexels = 128 * 128;
+
+static bool useTiledLayout(size_t width, size_t height)
+{
+	return width >= 8 && height >= 8 && width * height >= kTiledMinTexels;
+}
+
+/* The row major texels of src in 4x4 tiles, in dst which has the same size*/
+static void tileLevel(const MipLevel& src, MipLevel& dst)
+{
+	size_t tilesPerRow = (src.width + 3) >> 2, tileRows = (src.height + 3) >> 2;
+	dst.tiled = true;
+	dst.texels.assign(64 * tilesPerRow * tileRows, 0);
+	for (size_t y = 0; y < src.height; ++y)
+	{
+		const unsigned char *row = &src.texels[0] + 4 * y * src.width;
+		unsigned char *tileRow = &dst.texels[0] + 64 * tilesPerRow * (y >> 2) + 16 * (y & 3);
+		for (size_t x = 0; x < src.width; x += 4)
+		{
+			memcpy(tileRow + 16 * x, row + 4 * x, 4 * min((size_t)4, src.width - x));
+		}
+	}
+}
+
+/* The tiled texels of src, row major in dst*/
+static void untileLevel(const MipLevel& src, MipLevel& dst)
 {
-	uint8_t *src_uint8 = (uint8_t *)src;
-	dst[0] = src_uint8[0] / 255.f;
-	dst[1] = src_uint8[1] / 255.f;
-	dst[2] = src_uint8[2] / 255.f;
-	dst[3] = src_uint8[3] / 255.f;
+	dst.width = src.width;
+	dst.height = src.height;
+	dst.tiled = false;
+	dst.texels.resize(4 * src.width * src.height);
+	size_t tilesPerRow = (src.width + 3) >> 2;
+	for (size_t y = 0; y < src.height; ++y)
+	{
+		unsigned char *row = &dst.texels[0] + 4 * y * src.width;
+		const unsigned char *tileRow = &src.texels[0] + 64 * tilesPerRow * (y >> 2) + 16 * (y & 3);
+		for (size_t x = 0; x < src.width; x += 4)
+		{
+			memcpy(row + 4 * x, tileRow + 16 * x, 4 * min((size_t)4, src.width - x));
+		}
+	}
 }
 
-inline void float_to_uint8(unsigned char *dst, float src[4]) 
+/*
+* Rows [yBegin, yEnd) of curr as the 2x2 box filter of prev, whose sizes are both even.
+* Integer sums, 2 texels per iteration with SSE2.
+*/
+static void downsampleBox(const MipLevel& prev, MipLevel& curr, size_t yBegin, size_t yEnd)
 {
-	uint8_t *dst_uint8 = (uint8_t *)dst;
-	dst_uint8[0] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[0])));
-	dst_uint8[1] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[1])));
-	dst_uint8[2] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[2])));
-	dst_uint8[3] = (uint8_t)(255.f * max(0.0f, min(1.0f, src[3])));
+	for (size_t y = yBegin; y < yEnd; ++y)
+	{
+		const unsigned char *row0 = &prev.texels[0] + 4 * prev.width * (2 * y);
+		const unsigned char *row1 = row0 + 4 * prev.width;
+		unsigned char *dst = &curr.texels[0] + 4 * curr.width * y;
+
+		size_t x = 0;
+#ifdef TEXTURE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi16(2);
+		for (; x + 2 <= curr.width; x += 2, row0 += 16, row1 += 16, dst += 8)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)row0), b = _mm_loadu_si128((const __m128i*)row1);
+			//Vertical sums of the source texels 0 1 and 2 3, then the horizontal sums in the low halves
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+			__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+			_mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(sum, sum));
+		}
+#endif
+		for (; x < curr.width; ++x, row0 += 8, row1 += 8, dst += 4)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				dst[c] = (unsigned char)((row0[c] + row0[c + 4] + row1[c] + row1[c + 4] + 2) >> 2);
+			}
+		}
+	}
+}
+
+/*
+* Filter weights along one axis of a level. An odd source size is reduced with a 3 texels trapezoid filter,
+* an even one with a 2 texels box, and an axis of size 1 is copied.
+*/
+struct MipAxis
+{
+	MipAxis(size_t prevSize, size_t currSize)
+	{
+		if (prevSize == currSize)
+		{
+			support = 1; decimal = 0.f; norm = 1.f; stride = 1;
+		}
+		else
+		{
+			support = (prevSize & 1) ? 3 : 2;
+			decimal = (prevSize & 1) ? 1.f / (float)currSize : 0.f;
+			norm = 1.f / (2.f + decimal);
+			stride = 2;
+		}
+	}
+
+	void weights(int i, float w[3]) const
+	{
+		w[0] = norm * (support == 1 ? 1.f : 1.f - decimal * i);
+		w[1] = norm;
+		w[2] = norm * decimal * (i + 1);
+	}
+
+	int	  support;
+	int	  stride; //source texels per texel
+	float decimal;
+	float norm;
+};
+
+/*
+* Rows [yBegin, yEnd) of curr as the trapezoid filter of prev, for any size of prev.
+* The 4 channels of a texel are filtered at once with SSE2 floats.
+*/
+static void downsampleTrapezoid(const MipLevel& prev, MipLevel& curr, size_t yBegin, size_t yEnd)
+{
+	MipAxis xAxis(prev.width, curr.width), yAxis(prev.height, curr.height);
+	size_t pitch = 4 * prev.width;
+
+	for (size_t y = yBegin; y < yEnd; ++y)
+	{
+		float hWeight[3];
+		yAxis.weights((int)y, hWeight);
+		const unsigned char *src = &prev.texels[0] + pitch * (yAxis.stride * y);
+		unsigned char *dst = &curr.texels[0] + 4 * curr.width * y;
+
+		for (size_t x = 0; x < curr.width; ++x, dst += 4)
+		{
+			float wWeight[3];
+			xAxis.weights((int)x, wWeight);
+			const unsigned char *texel = src + 4 * (xAxis.stride * x);
+
+#ifdef TEXTURE_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			__m128 result = _mm_setzero_ps();
+			for (int jj = 0; jj < yAxis.support; ++jj)
+			{
+				for (int ii = 0; ii < xAxis.support; ++ii)
+				{
+					__m128i t = _mm_cvtsi32_si128(*(const int*)(texel + pitch * jj + 4 * ii));
+					__m128 input = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(t, zero), zero));
+					result = _mm_add_ps(result, _mm_mul_ps(input, _mm_set1_ps(hWeight[jj] * wWeight[ii])));
+				}
+			}
+			__m128i out = _mm_cvttps_epi32(_mm_min_ps(result, _mm_set1_ps(255.f)));
+			out = _mm_packs_epi32(out, out);
+			*(int*)dst = _mm_cvtsi128_si32(_mm_packus_epi16(out, out));
+#else
+			float result[4] = { 0.f, 0.f, 0.f, 0.f };
+			for (int jj = 0; jj < yAxis.support; ++jj)
+			{
+				for (int ii = 0; ii < xAxis.support; ++ii)
+				{
+					float weight = hWeight[jj] * wWeight[ii];
+					const unsigned char *input = texel + pitch * jj + 4 * ii;
+					for (int c = 0; c < 4; ++c) result[c] += weight * input[c];
+				}
+			}
+			for (int c = 0; c < 4; ++c) dst[c] = (unsigned char)min(result[c], 255.f);
+#endif
+		}
+	}
+}
+
+/* Build curr from prev, bands of rows in parallel*/
+static void downsample(const MipLevel& prev, MipLevel& curr)
+{
+	bool box = !(prev.width & 1) && !(prev.height & 1);
+	size_t grain = max(kMipBandTexels / curr.width, (size_t)1);
+	ThreadPool::instance().parallelFor(curr.height, grain, [&](size_t yBegin, size_t yEnd)
+	{
+		if (box) downsampleBox(prev, curr, yBegin, yEnd);
+		else	 downsampleTrapezoid(prev, curr, yBegin, yEnd);
+	});
 }
 
 void Texture::generateMips(const MipLevel& mip0)
 {
+	lock_guard<mutex> lock(m_buildMutex);
+	mipmap.clear();
 	mipmap.push_back(mip0);
+	if (!mip0.tiled && useTiledLayout(mip0.width, mip0.height)) tileLevel(mip0, mipmap[0]);
 	int startLevel = 0;
 
-	// allocate sublevels
+	// size the sublevels, their texels are allocated when they are built
 	int baseWidth = mipmap[startLevel].width;
 	int baseHeight = mipmap[startLevel].height;
 	int numSubLevels = (int)(log2f((float)max(baseWidth, baseHeight)));
@@ -49,157 +226,83 @@ void Texture::generateMips(const MipLevel& mip0)
 
 		// handle odd size texture by rounding down
 		width = max(1, width / 2);
-		//assert (width > 0);
 		height = max(1, height / 2);
-		//assert (height > 0);
 
 		level.width = width;
 		level.height = height;
-		level.texels = vector<unsigned char>(4 * width * height);
 	}
+	m_builtLevels = startLevel + 1;
+}
 
-	// create mips
-	int subLevels = numSubLevels - (startLevel + 1);
-	for (int mipLevel = startLevel + 1; mipLevel < startLevel + subLevels + 1;
-		mipLevel++) {
-
-		MipLevel &prevLevel = mipmap[mipLevel - 1];
-		MipLevel &currLevel = mipmap[mipLevel];
-
-		int prevLevelPitch = prevLevel.width * 4; // 32 bit RGBA
-		int currLevelPitch = currLevel.width * 4; // 32 bit RGBA
-
-		unsigned char *prevLevelMem;
-		unsigned char *currLevelMem;
-
-		currLevelMem = (unsigned char *)&currLevel.texels[0];
-		prevLevelMem = (unsigned char *)&prevLevel.texels[0];
-
-		float wDecimal, wNorm, wWeight[3];
-		int wSupport;
-		float hDecimal, hNorm, hWeight[3];
-		int hSupport;
-
-		float result[4];
-		float input[4];
-
-		// conditional differentiates no rounding case from round down case
-		if (prevLevel.width & 1) {
-			wSupport = 3;
-			wDecimal = 1.0f / (float)currLevel.width;
-		}
-		else {
-			wSupport = 2;
-			wDecimal = 0.0f;
-		}
-
-		// conditional differentiates no rounding case from round down case
-		if (prevLevel.height & 1) {
-			hSupport = 3;
-			hDecimal = 1.0f / (float)currLevel.height;
-		}
-		else {
-			hSupport = 2;
-			hDecimal = 0.0f;
+const MipLevel& Texture::level(int i) const
+{
+	int firstLevel = m_builtLevels.load(memory_order_acquire);
+	if (i < firstLevel) return mipmap[i];
+
+	// create the missing mips, each level is filtered from the previous one.
+	// The filters read and write row major levels, the tiled ones are built in a row major copy first.
+	// The levels are built without the lock, downsample may run any task of the pool on this thread while
+	// it waits, and published under it. Threads racing for a level build the same texels, the first one wins.
+	vector<MipLevel> levels(i + 1 - firstLevel);
+	MipLevel linear[2];
+	int next = 0;
+	const MipLevel *prevLevel = &mipmap[firstLevel - 1];
+	if (prevLevel->tiled)
+	{
+		untileLevel(*prevLevel, linear[next]);
+		prevLevel = &linear[next];
+		next ^= 1;
+	}
+	for (int mipLevel = firstLevel; mipLevel <= i; mipLevel++) {
+		MipLevel &currLevel = levels[mipLevel - firstLevel];
+		currLevel.width = mipmap[mipLevel].width;
+		currLevel.height = mipmap[mipLevel].height;
+		if (useTiledLayout(currLevel.width, currLevel.height))
+		{
+			MipLevel &rowMajor = linear[next];
+			next ^= 1;
+			rowMajor.width = currLevel.width;
+			rowMajor.height = currLevel.height;
+			rowMajor.texels.resize(4 * currLevel.width * currLevel.height);
+			downsample(*prevLevel, rowMajor);
+			tileLevel(rowMajor, currLevel);
+			prevLevel = &rowMajor;
 		}
-
-		wNorm = 1.0f / (2.0f + wDecimal);
-		hNorm = 1.0f / (2.0f + hDecimal);
-
-		// case 1: reduction only in horizontal size (vertical size is 1)
-		if (currLevel.height == prevLevel.height) {
-			//assert (currLevel.height == 1);
-
-			for (int i = 0; i < currLevel.width; i++) {
-				wWeight[0] = wNorm * (1.0f - wDecimal * i);
-				wWeight[1] = wNorm * 1.0f;
-				wWeight[2] = wNorm * wDecimal * (i + 1);
-
-				result[0] = result[1] = result[2] = result[3] = 0.0f;
-
-				for (int ii = 0; ii < wSupport; ii++) {
-					uint8_to_float(input, prevLevelMem + 4 * (2 * i + ii));
-					result[0] += wWeight[ii] * input[0];
-					result[1] += wWeight[ii] * input[1];
-					result[2] += wWeight[ii] * input[2];
-					result[3] += wWeight[ii] * input[3];
-				}
-
-				// convert back to format of the texture
-				float_to_uint8(currLevelMem + (4 * i), result);
-			}
-
-			// case 2: reduction only in vertical size (horizontal size is 1)
+		else
+		{
+			currLevel.texels.resize(4 * currLevel.width * currLevel.height);
+			downsample(*prevLevel, currLevel);
+			prevLevel = &currLevel;
 		}
-		else if (currLevel.width == prevLevel.width) {
-			//assert (currLevel.width == 1);
-
-			for (int j = 0; j < currLevel.height; j++) {
-				hWeight[0] = hNorm * (1.0f - hDecimal * j);
-				hWeight[1] = hNorm;
-				hWeight[2] = hNorm * hDecimal * (j + 1);
-
-				result[0] = result[1] = result[2] = result[3] = 0.0f;
-				for (int jj = 0; jj < hSupport; jj++) {
-					uint8_to_float(input, prevLevelMem + prevLevelPitch * (2 * j + jj));
-					result[0] += hWeight[jj] * input[0];
-					result[1] += hWeight[jj] * input[1];
-					result[2] += hWeight[jj] * input[2];
-					result[3] += hWeight[jj] * input[3];
-				}
-
-				// convert back to format of the texture
-				float_to_uint8(currLevelMem + (currLevelPitch * j), result);
-			}
+	}
 
-			// case 3: reduction in both horizontal and vertical size
-		}
-		else {
-
-			for (int j = 0; j < currLevel.height; j++) {
-				hWeight[0] = hNorm * (1.0f - hDecimal * j);
-				hWeight[1] = hNorm;
-				hWeight[2] = hNorm * hDecimal * (j + 1);
-
-				for (int i = 0; i < currLevel.width; i++) {
-					wWeight[0] = wNorm * (1.0f - wDecimal * i);
-					wWeight[1] = wNorm * 1.0f;
-					wWeight[2] = wNorm * wDecimal * (i + 1);
-
-					result[0] = result[1] = result[2] = result[3] = 0.0f;
-
-					// convolve source image with a trapezoidal filter.
-					// in the case of no rounding this is just a box filter of width 2.
-					// in the general case, the support region is 3x3.
-					for (int jj = 0; jj < hSupport; jj++)
-						for (int ii = 0; ii < wSupport; ii++) {
-							float weight = hWeight[jj] * wWeight[ii];
-							uint8_to_float(input, prevLevelMem +
-								prevLevelPitch * (2 * j + jj) +
-								4 * (2 * i + ii));
-							result[0] += weight * input[0];
-							result[1] += weight * input[1];
-							result[2] += weight * input[2];
-							result[3] += weight * input[3];
-						}
-
-					// convert back to format of the texture
-					float_to_uint8(currLevelMem + currLevelPitch * j + 4 * i, result);
-				}
-			}
-		}
+	lock_guard<mutex> lock(m_buildMutex);
+	for (int mipLevel = m_builtLevels.load(memory_order_relaxed); mipLevel <= i; mipLevel++) {
+		MipLevel &built = levels[mipLevel - firstLevel];
+		mipmap[mipLevel].texels.swap(built.texels);
+		mipmap[mipLevel].tiled = built.tiled;
+		m_builtLevels.store(mipLevel + 1, memory_order_release);
 	}
+	return mipmap[i];
+}
+
+size_t Texture::bytes() const
+{
+	size_t total = 0;
+	int builtLevels = m_builtLevels.load(memory_order_acquire);
+	for (int i = 0; i < builtLevels; ++i) total += mipmap[i].texels.capacity();
+	return total;
 }
 
 Color Sampler2D::sampleNearest(const Texture& tex, float u, float v, int level )
 {
-	const MipLevel& mip = tex.mipmap[level];
+	const MipLevel& mip = tex.level(level);
 
 	int su = (int)floor(u * mip.width);
 	int sv = (int)floor(v * mip.height);
 
-	if (su < 0 || su > mip.width || sv < 0 || sv > mip.height ) return Color::White;
-	return Color(&mip.texels[0] + 4 * (su + sv * mip.width));
+	if (su < 0 || su >= mip.width || sv < 0 || sv >= mip.height ) return Color::White;
+	return Color(mip.texel(su, sv));
 }
 
 
@@ -208,14 +311,14 @@ Color Sampler2D::sampleBilinear(const Texture& tex, float u, float v, int level)
 	
 	if (u < 0. || u > 1. || v < 0. || v > 1.) return Color::White;
 
-	const MipLevel& mip = tex.mipmap[level];
+	const MipLevel& mip = tex.level(level);
 	u = u * (float)mip.width;
 	v = v * (float)mip.height;
 
 	if ( u < 0.5 || u > (float)mip.width - 0.5 || v < 0.5 || v > (float)mip.height - 0.5)
 	{
-		int su = u, sv = v;
-		return Color(&mip.texels[0] + 4 * (su + sv * mip.width));
+		int su = min((int)u, (int)mip.width - 1), sv = min((int)v, (int)mip.height - 1);
+		return Color(mip.texel(su, sv));
 	}
 
 	int su1 = round(u), sv1 = round(v);
@@ -224,10 +327,10 @@ Color Sampler2D::sampleBilinear(const Texture& tex, float u, float v, int level)
 	int su0 = su1 - 1,  sv0 = sv1 - 1;
 	_ASSERT(su0 >= 0 && su0 < mip.width);
 	_ASSERT(sv0 >= 0 && sv0 < mip.height);
-	Color c1(&mip.texels[0] + 4 * (su0 + sv0 * mip.width));
-	Color c2(&mip.texels[0] + 4 * (su1 + sv0 * mip.width));
-	Color c3(&mip.texels[0] + 4 * (su0 + sv1 * mip.width));
-	Color c4(&mip.texels[0] + 4 * (su1 + sv1 * mip.width));
+	Color c1(mip.texel(su0, sv0));
+	Color c2(mip.texel(su1, sv0));
+	Color c3(mip.texel(su0, sv1));
+	Color c4(mip.texel(su1, sv1));
 
 	//in u dir
 	float tu = u - ((float)su0 + 0.5);
@@ -240,7 +343,7 @@ Color Sampler2D::sampleBilinear(const Texture& tex, float u, float v, int level)
 
 Color Sampler2D::sampleTrilinear (const Texture& tex, float u, float v, float u_scale, float v_scale)
 {
-	float L = log2f( max(u_scale * tex.mipmap[0].width, v_scale * tex.mipmap[0].height));
+	float L = log2f( max(u_scale * tex.width, v_scale * tex.height));
 	int Llow = max(0.f, floor(L));
 	int Lhigh = Llow + 1; _ASSERT(Lhigh <= kMaxMipLevels);
 	float t = L - Llow;
@@ -248,4 +351,143 @@ Color Sampler2D::sampleTrilinear (const Texture& tex, float u, float v, float u_
 	return (1 - t) * sampleBilinear(tex, u, v, Llow) + t * sampleBilinear(tex, u, v, Lhigh);
 }
 
-}
\ No newline at end of file
+/*
+* Texel coordinates of a span are 16.16 fixed point, clamped to the texel centers at the edges.
+* The bilinear weights are 7 bit, their products fit the 16 bit lanes of madd.
+*/
+struct BilinearTap
+{
+	const unsigned char *t00, *t10, *t01, *t11;
+	int w00, w10, w01, w11; //sum to 1 << 14
+};
+
+/* Byte offsets in a row major level*/
+struct RowMajorTexels
+{
+	explicit RowMajorTexels(const MipLevel& mip) : pitch(4 * (int)mip.width) {}
+	int offset(int x, int y) const { return y * pitch + 4 * x; }
+	int nextX(int)			 const { return 4; }
+	int nextY(int)			 const { return pitch; }
+	int pitch;
+};
+
+/* Byte offsets in a tiled level, the next texel is in the next tile after the last column or row of a tile*/
+struct TiledTexels
+{
+	explicit TiledTexels(const MipLevel& mip) : tileRowPitch(16 * (((int)mip.width + 3) & ~3)) {}
+	int offset(int x, int y) const { return (y >> 2) * tileRowPitch + ((y & 3) << 4) + ((x & ~3) << 4) + ((x & 3) << 2); }
+	int nextX(int x)		 const { return (x & 3) == 3 ? 64 - 12 : 4; }
+	int nextY(int y)		 const { return (y & 3) == 3 ? tileRowPitch - 48 : 16; }
+	int tileRowPitch;
+};
+
+template <class Texels>
+static inline void bilinearTap(const MipLevel& mip, const Texels& texels, int U, int V, int maxU, int maxV, BilinearTap& tap)
+{
+	U = min(max(U, 0), maxU);
+	V = min(max(V, 0), maxV);
+	int x0 = U >> 16, y0 = V >> 16;
+	int fx = (U >> 9) & 127, fy = (V >> 9) & 127;
+
+	//The neighbors past the last texel are the texel itself
+	int dx = x0 + 1 < (int)mip.width  ? texels.nextX(x0) : 0;
+	int dy = y0 + 1 < (int)mip.height ? texels.nextY(y0) : 0;
+	tap.t00 = &mip.texels[0] + texels.offset(x0, y0); tap.t10 = tap.t00 + dx;
+	tap.t01 = tap.t00 + dy;							  tap.t11 = tap.t01 + dx;
+	tap.w00 = (128 - fx) * (128 - fy);	tap.w10 = fx * (128 - fy);
+	tap.w01 = (128 - fx) * fy;			tap.w11 = fx * fy;
+}
+
+#ifdef TEXTURE_SSE2
+/* The filtered RGBA of a tap in the 4 32 bit lanes, before the final shift*/
+static inline __m128i filterTap(const BilinearTap& tap, __m128i zero)
+{
+	__m128i top = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)tap.t00), _mm_cvtsi32_si128(*(const int*)tap.t10));
+	__m128i bottom = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)tap.t01), _mm_cvtsi32_si128(*(const int*)tap.t11));
+	//r00 r10 g00 g10 b00 b10 a00 a10, multiplied by w00 w10 and summed by pairs
+	__m128i sum = _mm_madd_epi16(_mm_unpacklo_epi8(top, zero), _mm_set1_epi32(tap.w00 | (tap.w10 << 16)));
+	sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(bottom, zero), _mm_set1_epi32(tap.w01 | (tap.w11 << 16))));
+	return sum;
+}
+#endif
+
+/* The span of sampleBilinearSpan in texel space, specialized for the layout of the level*/
+template <class Texels>
+static void bilinearSpan(const MipLevel& mip, int U, int V, int dU, int dV, int maxU, int maxV,
+						 size_t count, unsigned char* dst)
+{
+	Texels texels(mip);
+	BilinearTap tap;
+	size_t i = 0;
+#ifdef TEXTURE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << 13);
+	for (; i + 4 <= count; i += 4, dst += 16)
+	{
+		__m128i s[4];
+		for (int k = 0; k < 4; ++k, U += dU, V += dV)
+		{
+			bilinearTap(mip, texels, U, V, maxU, maxV, tap);
+			s[k] = _mm_srli_epi32(_mm_add_epi32(filterTap(tap, zero), round), 14);
+		}
+		__m128i pixels = _mm_packus_epi16(_mm_packs_epi32(s[0], s[1]), _mm_packs_epi32(s[2], s[3]));
+		_mm_storeu_si128((__m128i*)dst, pixels);
+	}
+#endif
+	for (; i < count; ++i, dst += 4, U += dU, V += dV)
+	{
+		bilinearTap(mip, texels, U, V, maxU, maxV, tap);
+		for (int c = 0; c < 4; ++c)
+		{
+			dst[c] = (unsigned char)((tap.t00[c] * tap.w00 + tap.t10[c] * tap.w10 +
+									  tap.t01[c] * tap.w01 + tap.t11[c] * tap.w11 + (1 << 13)) >> 14);
+		}
+	}
+}
+
+void Sampler2D::sampleBilinearSpan(const Texture& tex, int level, float u, float v, float dudx, float dvdx,
+								   size_t count, unsigned char* dst)
+{
+	const MipLevel& mip = tex.level(level);
+	if (mip.texels.empty()) return;
+
+	//Texel space, the texel centers are at integer coordinates
+	int maxU = ((int)mip.width - 1) << 16, maxV = ((int)mip.height - 1) << 16;
+	double fu = ((double)u * mip.width - 0.5) * 65536., fv = ((double)v * mip.height - 0.5) * 65536.;
+	int U = (int)min(max(fu, -65536.), maxU + 65536.), dU = (int)(dudx * mip.width * 65536.f);
+	int V = (int)min(max(fv, -65536.), maxV + 65536.), dV = (int)(dvdx * mip.height * 65536.f);
+
+	if (mip.tiled) bilinearSpan<TiledTexels>   (mip, U, V, dU, dV, maxU, maxV, count, dst);
+	else		   bilinearSpan<RowMajorTexels>(mip, U, V, dU, dV, maxU, maxV, count, dst);
+}
+
+void Sampler2D::sampleTrilinearSpan(const Texture& tex, int level, int weight, float u, float v, float dudx, float dvdx,
+									size_t count, unsigned char* dst, unsigned char* scratch)
+{
+	sampleBilinearSpan(tex, level,	   u, v, dudx, dvdx, count, dst);
+	sampleBilinearSpan(tex, level + 1, u, v, dudx, dvdx, count, scratch);
+
+	//dst = (dst * (256 - weight) + scratch * weight) >> 8, the sums fit the unsigned 16 bit lanes
+	size_t i = 0, n = 4 * count;
+#ifdef TEXTURE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w1 = _mm_set1_epi16((short)weight), w0 = _mm_set1_epi16((short)(256 - weight));
+	const __m128i round = _mm_set1_epi16(128);
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i*)(scratch + i));
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), w0), _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), w1));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), w0), _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), w1));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < n; ++i)
+	{
+		dst[i] = (unsigned char)((dst[i] * (256 - weight) + scratch[i] * weight + 128) >> 8);
+	}
+}
+
+}
@@ -2,6 +2,8 @@
 #define TEXTURE_H
 
 #include <vector>
+#include <mutex>
+#include <atomic>
 
 namespace CGCore
 {
@@ -10,18 +12,56 @@ class Color;
 
 static const int kMaxMipLevels = 14;
 
+/*
+* The texels of a level are RGBA, row major, or in 4x4 tiles when the level is large enough that
+* a row major walk across rows misses the cache on every texel. A tile is 64 bytes, one cache line,
+* with its texels row major and the tiles themselves row major. Tiled levels are padded to whole tiles.
+*/
 struct MipLevel {
+	MipLevel() : width(0), height(0), tiled(false) {}
+
 	size_t width;
 	size_t height;
+	bool   tiled;
 	std::vector<unsigned char> texels;
+
+	const unsigned char* texel(size_t x, size_t y) const
+	{
+		if (!tiled) return &texels[4 * (x + y * width)];
+		size_t tilesPerRow = (width + 3) >> 2;
+		return &texels[(((y >> 2) * tilesPerRow + (x >> 2)) << 6) + ((y & 3) << 4) + ((x & 3) << 2)];
+	}
 };
 
+/*
+* A texture and its mip chain. The sub levels are only built, and their texels only allocated,
+* the first time level() asks for them. Not copyable.
+*/
 struct Texture
 {
+	Texture() : width(0), height(0), m_builtLevels(0) {}
+
 	size_t width;
 	size_t height;
-	std::vector<MipLevel> mipmap;
+
+	/* Set level 0 and the sizes of the chain, the sub levels are built on demand*/
 	void generateMips(const MipLevel& mip0);
+
+	size_t levelCount() const { return mipmap.size(); }
+
+	/* Level i, built from the previous levels on the first call. Thread safe.*/
+	const MipLevel& level(int i) const;
+
+	/* Bytes of the texels allocated so far, the padding of the tiles included. Thread safe.*/
+	size_t bytes() const;
+
+private:
+	Texture(const Texture&);
+	Texture& operator=(const Texture&);
+
+	mutable std::vector<MipLevel> mipmap;		  //sized by generateMips, never reallocated after
+	mutable std::mutex			  m_buildMutex;	  //publishes the levels, not held while they are built
+	mutable std::atomic<int>	  m_builtLevels;  //levels [0, m_builtLevels) have their texels
 };
 
 class Sampler2D
@@ -30,6 +70,20 @@ public:
 	static Color sampleNearest(const Texture& tex, float u, float v, int level = 0);
 	static Color sampleBilinear(const Texture& tex, float u, float v, int level = 0);
 	static Color sampleTrilinear(const Texture& tex, float u, float v, float u_scale, float v_scale);
+
+	/*
+	* Bilinear samples of count pixels, the first at (u, v) and then stepping (dudx, dvdx) per pixel.
+	* Written to dst as RGBA pixels, the alpha filtered like the colors.
+	*/
+	static void sampleBilinearSpan(const Texture& tex, int level, float u, float v, float dudx, float dvdx,
+								   size_t count, unsigned char* dst);
+
+	/*
+	* Same span, blending the bilinear samples of level and level + 1 with the constant weight / 256 of level + 1.
+	* scratch receives the samples of level + 1, 4 * count bytes.
+	*/
+	static void sampleTrilinearSpan(const Texture& tex, int level, int weight, float u, float v, float dudx, float dvdx,
+									size_t count, unsigned char* dst, unsigned char* scratch);
 };
 
 }
@@ -0,0 +1,140 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace CGCore
+{
+
+ThreadPool& ThreadPool::instance()
+{
+	static ThreadPool pool(max(1u, thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+ThreadPool::ThreadPool(size_t workers) : m_stop(false)
+{
+	for (size_t i = 0; i < workers; ++i)
+	{
+		m_workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wakeUp.notify_all();
+
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		m_workers[i].join();
+	}
+}
+
+void ThreadPool::submit(TaskGroup *group, const function<void()>& task)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		Task t = { task, group };
+		m_queue.push_back(t);
+	}
+	m_wakeUp.notify_one();
+}
+
+/* Run one queued task on the calling thread. Returns false if the queue was empty*/
+bool ThreadPool::runOne()
+{
+	Task task;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if (m_queue.empty()) return false;
+		task = m_queue.front();
+		m_queue.pop_front();
+	}
+
+	task.run();
+	task.group->finish();
+	return true;
+}
+
+void ThreadPool::workerLoop()
+{
+	for (;;)
+	{
+		Task task;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_wakeUp.wait(lock, [this]{ return m_stop || !m_queue.empty(); });
+			if (m_queue.empty()) return; //stopping
+			task = m_queue.front();
+			m_queue.pop_front();
+		}
+
+		task.run();
+		task.group->finish();
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const function<void(size_t, size_t)>& body)
+{
+	if (count == 0) return;
+	grain = max(grain, (size_t)1);
+
+	//A few ranges per thread, so a slow range does not hold the others
+	size_t ranges = min((count + grain - 1) / grain, 4 * concurrency());
+	if (ranges <= 1)
+	{
+		body(0, count);
+		return;
+	}
+
+	size_t step = (count + ranges - 1) / ranges;
+	TaskGroup group(*this);
+	for (size_t begin = step; begin < count; begin += step)
+	{
+		size_t end = min(begin + step, count);
+		group.run([&body, begin, end]{ body(begin, end); });
+	}
+	body(0, min(step, count));
+	group.wait();
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : m_pool(pool), m_pending(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+	wait();
+}
+
+void TaskGroup::run(const function<void()>& task)
+{
+	++m_pending;
+	m_pool.submit(this, task);
+}
+
+/* Called by the thread that ran a task. Under the lock, so the group can't be destroyed before it returns*/
+void TaskGroup::finish()
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (--m_pending == 0) m_done.notify_all();
+}
+
+/*
+* Wait for all the tasks of the group. Queued tasks (of any group) are run meanwhile,
+* and the thread only sleeps once the queue is empty and the remaining tasks are running elsewhere.
+*/
+void TaskGroup::wait()
+{
+	while (m_pending > 0 && m_pool.runOne()) {}
+
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [this]{ return m_pending == 0; });
+}
+
+}
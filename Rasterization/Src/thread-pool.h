@@ -0,0 +1,86 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace CGCore
+{
+
+class TaskGroup;
+
+/*
+* A fixed set of worker threads sharing one task queue.
+* Tasks are submitted through a TaskGroup, which is the unit the caller waits on.
+* A thread waiting on a group runs queued tasks meanwhile, so tasks may submit and wait on nested groups.
+*/
+class ThreadPool
+{
+public:
+	/* The process wide pool, one worker per hardware thread except the calling one*/
+	static ThreadPool& instance();
+
+	explicit ThreadPool(size_t workers);
+	~ThreadPool();
+
+	/* Number of threads running tasks, the caller of wait() included*/
+	size_t concurrency() const { return m_workers.size() + 1; }
+
+	/*
+	* Call body(begin, end) on consecutive ranges covering [0, count), each range at least grain long.
+	* Returns when all the ranges are done, the calling thread runs ranges too.
+	*/
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+private:
+	friend class TaskGroup;
+
+	struct Task
+	{
+		std::function<void()> run;
+		TaskGroup			 *group;
+	};
+
+	void submit(TaskGroup *group, const std::function<void()>& task);
+	bool runOne();
+	void workerLoop();
+
+	std::vector<std::thread>  m_workers;
+	std::deque<Task>		  m_queue;
+	std::mutex				  m_mutex;
+	std::condition_variable	  m_wakeUp;
+	bool					  m_stop;
+};
+
+/*
+* A set of tasks to wait for. The destructor waits for the tasks not yet done.
+*/
+class TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool& pool = ThreadPool::instance());
+	~TaskGroup();
+
+	void run(const std::function<void()>& task);
+
+	void wait();
+
+private:
+	friend class ThreadPool;
+
+	void finish();
+
+	ThreadPool&				 m_pool;
+	std::atomic<int>		 m_pending;
+	std::mutex				 m_mutex;
+	std::condition_variable	 m_done;
+};
+
+}
+
+#endif
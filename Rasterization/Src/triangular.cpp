@@ -1,5 +1,3 @@
-#include "vector2D.h"
-#include "svg.h"
 #include "triangular.h"
 
 using namespace std;
@@ -32,59 +30,54 @@ bool inside(float Ax, float Ay,
 };
 
 
-float area(const vector<Vector2D> &contour) 
+float area(const float* x, const float* y, int n) 
 {
 
-	int n = contour.size();
-
 	float a = 0.0f;
 	for (int p = n - 1, q = 0; q<n; p = q++) {
-		a += contour[p].x * contour[q].y - contour[q].x * contour[p].y;
+		a += (double)x[p] * y[q] - (double)x[q] * y[p];
 	}
 
 	return a * 0.5f;
 }
 
-bool snip(const vector<Vector2D>& contour, int u, int v, int w, int n, int *V) 
+bool snip(const float* x, const float* y, int u, int v, int w, int n, int *V) 
 {
 
 	int p;
 	float Ax, Ay, Bx, By, Cx, Cy, Px, Py;
 
-	Ax = contour[V[u]].x;
-	Ay = contour[V[u]].y;
+	Ax = x[V[u]];
+	Ay = y[V[u]];
 
-	Bx = contour[V[v]].x;
-	By = contour[V[v]].y;
+	Bx = x[V[v]];
+	By = y[V[v]];
 
-	Cx = contour[V[w]].x;
-	Cy = contour[V[w]].y;
+	Cx = x[V[w]];
+	Cy = y[V[w]];
 
 	if (EPSILON > (((Bx - Ax)*(Cy - Ay)) - ((By - Ay)*(Cx - Ax)))) return false;
 
 	for (p = 0; p < n; p++) {
 		if ((p == u) || (p == v) || (p == w)) continue;
-		Px = contour[V[p]].x;
-		Py = contour[V[p]].y;
+		Px = x[V[p]];
+		Py = y[V[p]];
 		if (inside(Ax, Ay, Bx, By, Cx, Cy, Px, Py)) return false;
 	}
 
 	return true;
 }
 
-// triangulates a polygon and save the result as a triangle list
-void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles)
+// triangulates the polygon (x, y)[0, n) and append the result to indices, 3 vertex indices per triangle
+void triangulate(const float* x, const float* y, int n, std::vector<uint32_t>& indices)
 {
-	const vector<Vector2D>& contour = polygon.points;
-
 	// allocate and initialize list of vertices in polygon
-	int n = contour.size();
 	if (n < 3) return;
 
 	int *V = new int[n];
 
 	// we want a counter-clockwise polygon in V
-	if (0.0f < area(contour)) 
+	if (0.0f < area(x, y, n)) 
 	{
 		for (int v = 0; v<n; v++) V[v] = v;
 	}
@@ -114,7 +107,7 @@ void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles)
 		v = u + 1; if (nv <= v) v = 0;      // new v   
 		int w = v + 1; if (nv <= w) w = 0;      // next    
 
-		if (snip(contour, u, v, w, nv, V)) 
+		if (snip(x, y, u, v, w, nv, V)) 
 		{
 
 			int a, b, c, s, t;
@@ -123,9 +116,9 @@ void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles)
 			a = V[u]; b = V[v]; c = V[w];
 
 			// output Triangle
-			triangles.push_back(contour[a]);
-			triangles.push_back(contour[b]);
-			triangles.push_back(contour[c]);
+			indices.push_back(a);
+			indices.push_back(b);
+			indices.push_back(c);
 
 			m++;
 
@@ -2,13 +2,11 @@
 #define TRIANGULAR_H
 
 #include <vector>
+#include <cstdint>
 
 namespace CGCore
 {
 
-struct Polygon;
-struct Vector2D;
-
 /*Triangular Edge For edge testing
 */
 struct Edge
@@ -50,8 +48,8 @@ struct Triangle
 	Edge e2;
 };
 
-// triangulates a polygon and save the result as a triangle list
-void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles);
+// triangulates the polygon (x, y)[0, n) and append the result to indices, 3 vertex indices per triangle
+void triangulate(const float* x, const float* y, int n, std::vector<uint32_t>& indices);
 
 }
 
@@ -0,0 +1,334 @@
+#include "xml-tokenizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+namespace CGCore
+{
+
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Characters ending a name. Names are not checked further.*/
+static inline bool endsName(char c)
+{
+	return isSpace(c) || c == '>' || c == '/' || c == '=';
+}
+
+static void appendUTF8(vector<char>& out, unsigned long code)
+{
+	if (code < 0x80)
+	{
+		out.push_back((char)code);
+	}
+	else if (code < 0x800)
+	{
+		out.push_back((char)(0xC0 | (code >> 6)));
+		out.push_back((char)(0x80 | (code & 0x3F)));
+	}
+	else if (code < 0x10000)
+	{
+		out.push_back((char)(0xE0 | (code >> 12)));
+		out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+		out.push_back((char)(0x80 | (code & 0x3F)));
+	}
+	else
+	{
+		out.push_back((char)(0xF0 | (code >> 18)));
+		out.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+		out.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+		out.push_back((char)(0x80 | (code & 0x3F)));
+	}
+}
+
+XMLTokenizer::XMLTokenizer(const char* text, size_t size)
+	: m_text(text), m_end(text + size), m_pos(text), m_error(NULL), m_structureOnly(false), m_name(NULL), m_nameLength(0), m_empty(false)
+{
+	//UTF-8 byte order mark
+	if (size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) m_pos += 3;
+}
+
+XMLTokenizer::XMLTokenizer(const char* text, const char* begin, const char* end)
+	: m_text(text), m_end(end), m_pos(begin), m_error(NULL), m_structureOnly(false), m_name(NULL), m_nameLength(0), m_empty(false)
+{
+}
+
+XMLTokenizer::Token XMLTokenizer::fail(const char* error)
+{
+	if (!m_error) m_error = error;
+	return TOKEN_ERROR;
+}
+
+int XMLTokenizer::errorLine() const
+{
+	return 1 + (int)count(m_text, m_pos, '\n');
+}
+
+XMLTokenizer::Token XMLTokenizer::next()
+{
+	if (m_error) return TOKEN_ERROR;
+	if (m_empty)
+	{
+		m_empty = false;
+		m_open.pop_back();
+		return TOKEN_END;
+	}
+
+	for (;;)
+	{
+		//text up to the next markup. An empty document has no text at all.
+		const char* markup = m_pos < m_end ? (const char*)memchr(m_pos, '<', m_end - m_pos) : NULL;
+		if (!markup)
+		{
+			m_pos = m_end;
+			return m_open.empty() ? TOKEN_EOF : fail("unexpected end of file");
+		}
+		m_pos = markup + 1;
+		if (m_pos == m_end) return fail("unexpected end of file");
+
+		switch (*m_pos)
+		{
+		case '?':
+			if (!skipPast("?>")) return fail("unterminated processing instruction");
+			break;
+		case '!':
+			if (m_end - m_pos >= 3 && memcmp(m_pos, "!--", 3) == 0)
+			{
+				if (!skipPast("-->")) return fail("unterminated comment");
+			}
+			else if (m_end - m_pos >= 8 && memcmp(m_pos, "![CDATA[", 8) == 0)
+			{
+				if (!skipPast("]]>")) return fail("unterminated CDATA section");
+			}
+			else if (!skipDeclaration()) return fail("unterminated declaration");
+			break;
+		case '/':
+			return readEndTag();
+		default:
+			return readStartTag();
+		}
+	}
+}
+
+XMLTokenizer::Token XMLTokenizer::skipElement()
+{
+	//the values of the skipped tags are never read
+	bool structureOnly = m_structureOnly;
+	m_structureOnly = true;
+
+	size_t depth = 1;
+	Token token;
+	for (;;)
+	{
+		token = next();
+		if (token == TOKEN_START) ++depth;
+		else if (token == TOKEN_END) { if (--depth == 0) break; }
+		else
+		{
+			if (token == TOKEN_EOF) token = fail("unexpected end of file");
+			break;
+		}
+	}
+
+	m_structureOnly = structureOnly;
+	return token;
+}
+
+bool XMLTokenizer::skipPast(const char* terminator)
+{
+	size_t length = strlen(terminator);
+	for (const char* p = m_pos; m_end - p >= (ptrdiff_t)length; ++p)
+	{
+		p = (const char*)memchr(p, terminator[0], m_end - p);
+		if (!p || m_end - p < (ptrdiff_t)length) break;
+		if (memcmp(p, terminator, length) == 0)
+		{
+			m_pos = p + length;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* <!DOCTYPE ...> and the like, with an internal subset in brackets and quoted strings*/
+bool XMLTokenizer::skipDeclaration()
+{
+	int brackets = 0;
+	for (const char* p = m_pos; p < m_end; ++p)
+	{
+		char c = *p;
+		if (c == '"' || c == '\'')
+		{
+			p = (const char*)memchr(p + 1, c, m_end - p - 1);
+			if (!p) return false;
+		}
+		else if (c == '[') ++brackets;
+		else if (c == ']') --brackets;
+		else if (c == '>' && brackets <= 0)
+		{
+			m_pos = p + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+XMLTokenizer::Token XMLTokenizer::readEndTag()
+{
+	const char* name = ++m_pos;
+	while (m_pos < m_end && !endsName(*m_pos)) ++m_pos;
+	size_t length = m_pos - name;
+	while (m_pos < m_end && isSpace(*m_pos)) ++m_pos;
+	if (m_pos == m_end || *m_pos != '>') return fail("malformed end tag");
+	++m_pos;
+
+	if (m_open.empty()) return fail("end tag without a start tag");
+	if (m_open.back().second != length || memcmp(m_open.back().first, name, length) != 0) return fail("mismatched end tag");
+	m_open.pop_back();
+	return TOKEN_END;
+}
+
+XMLTokenizer::Token XMLTokenizer::readStartTag()
+{
+	m_name = m_pos;
+	while (m_pos < m_end && !endsName(*m_pos)) ++m_pos;
+	m_nameLength = m_pos - m_name;
+	if (m_nameLength == 0) return fail("malformed start tag");
+
+	m_attributes.clear();
+	m_values.clear();
+	for (;;)
+	{
+		while (m_pos < m_end && isSpace(*m_pos)) ++m_pos;
+		if (m_pos == m_end) return fail("unexpected end of file");
+
+		if (*m_pos == '>')
+		{
+			++m_pos;
+			break;
+		}
+		if (*m_pos == '/')
+		{
+			if (m_end - m_pos < 2 || m_pos[1] != '>') return fail("malformed start tag");
+			m_pos += 2;
+			m_empty = true;
+			break;
+		}
+
+		//name="value"
+		Attribute attr;
+		attr.name = m_pos;
+		while (m_pos < m_end && !endsName(*m_pos)) ++m_pos;
+		attr.nameLength = m_pos - attr.name;
+		while (m_pos < m_end && isSpace(*m_pos)) ++m_pos;
+		if (attr.nameLength == 0 || m_pos == m_end || *m_pos != '=') return fail("malformed attribute");
+		++m_pos;
+		while (m_pos < m_end && isSpace(*m_pos)) ++m_pos;
+		if (m_pos == m_end || (*m_pos != '"' && *m_pos != '\'')) return fail("attribute value not quoted");
+
+		const char* begin = m_pos + 1;
+		const char* end = (const char*)memchr(begin, *m_pos, m_end - begin);
+		if (!end) return fail("unterminated attribute value");
+		if (!m_structureOnly)
+		{
+			attr.value = m_values.size();
+			if (!readValue(begin, end)) return fail("malformed entity");
+			m_attributes.push_back(attr);
+		}
+		m_pos = end + 1;
+	}
+
+	m_open.push_back(make_pair(m_name, m_nameLength));
+	return TOKEN_START;
+}
+
+/* Append the value to m_values, replacing the entities*/
+bool XMLTokenizer::readValue(const char* begin, const char* end)
+{
+	const char* amp = (const char*)memchr(begin, '&', end - begin);
+	if (!amp)
+	{
+		m_values.insert(m_values.end(), begin, end);
+		m_values.push_back(0);
+		return true;
+	}
+
+	static const struct { const char* name; size_t length; char value; } kEntities[] =
+	{
+		{ "lt;", 3, '<' }, { "gt;", 3, '>' }, { "amp;", 4, '&' }, { "quot;", 5, '"' }, { "apos;", 5, '\'' },
+	};
+
+	const char* p = begin;
+	while (p < end)
+	{
+		if (*p != '&')
+		{
+			m_values.push_back(*p++);
+			continue;
+		}
+
+		const char* semicolon = (const char*)memchr(p, ';', end - p);
+		if (!semicolon) return false;
+		if (p[1] == '#')
+		{
+			//character reference, decimal or hexadecimal
+			bool hex = p[2] == 'x' || p[2] == 'X';
+			const char* digits = p + (hex ? 3 : 2);
+			char* digitsEnd = NULL;
+			unsigned long code = strtoul(digits, &digitsEnd, hex ? 16 : 10);
+			if (digitsEnd != semicolon || digits == semicolon || code == 0 || code > 0x10FFFF) return false;
+			appendUTF8(m_values, code);
+		}
+		else
+		{
+			size_t e = 0, count = sizeof(kEntities) / sizeof(kEntities[0]);
+			while (e < count && ((size_t)(semicolon - p) != kEntities[e].length || memcmp(p + 1, kEntities[e].name, kEntities[e].length) != 0)) ++e;
+			if (e == count) return false;
+			m_values.push_back(kEntities[e].value);
+		}
+		p = semicolon + 1;
+	}
+	m_values.push_back(0);
+	return true;
+}
+
+bool XMLTokenizer::nameIs(const char* name) const
+{
+	return strlen(name) == m_nameLength && memcmp(name, m_name, m_nameLength) == 0;
+}
+
+const char* XMLTokenizer::attribute(const char* name) const
+{
+	size_t length = strlen(name);
+	for (size_t i = 0; i < m_attributes.size(); ++i)
+	{
+		const Attribute& attr = m_attributes[i];
+		if (attr.nameLength == length && memcmp(attr.name, name, length) == 0) return &m_values[attr.value];
+	}
+	return NULL;
+}
+
+float XMLTokenizer::floatAttribute(const char* name) const
+{
+	float value = 0.f;
+	queryFloatAttribute(name, &value);
+	return value;
+}
+
+bool XMLTokenizer::queryFloatAttribute(const char* name, float* value) const
+{
+	const char* text = attribute(name);
+	if (!text) return false;
+	char* end = NULL;
+	double parsed = strtod(text, &end);
+	if (end == text) return false;
+	*value = (float)parsed;
+	return true;
+}
+
+}
@@ -0,0 +1,97 @@
+#ifndef XML_TOKENIZER_H
+#define XML_TOKENIZER_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstddef>
+
+namespace CGCore
+{
+
+/*
+* Pull tokenizer over XML text held in memory, typically a mapped file. It reads one tag at a time and keeps
+* nothing of the tags already read but the names of the open elements, so its memory doesn't grow with the
+* size of the document. Text, comments, processing instructions, CDATA sections and the DOCTYPE are skipped.
+*/
+class XMLTokenizer
+{
+public:
+	enum Token
+	{
+		TOKEN_START = 0, //a start tag, its name and attributes can be read until the next call
+		TOKEN_END,		 //the end of an element, also given after an empty element tag such as <rect/>
+		TOKEN_EOF,
+		TOKEN_ERROR,
+	};
+
+	XMLTokenizer(const char* text, size_t size);
+
+	/* Tokenize the part [begin, end) of text, such as elements found by an earlier pass. Errors are located in the whole text.*/
+	XMLTokenizer(const char* text, const char* begin, const char* end);
+
+	Token next();
+
+	/* Read the tags without their attribute values, for a pass looking only at the structure of the document*/
+	void		setStructureOnly(bool structureOnly) { m_structureOnly = structureOnly; }
+
+	/* Skip the content of the element whose start tag was read last, its end included*/
+	Token skipElement();
+
+	/* Name of the last start tag*/
+	bool		nameIs(const char* name) const;
+	std::string name() const { return std::string(m_name, m_nameLength); }
+
+	/* The whole text, where the last start tag begins in it, and where the next token will be read from*/
+	const char* text() const { return m_text; }
+	const char* tagBegin() const { return m_name - 1; }
+	const char* position() const { return m_pos; }
+
+	/* Value of an attribute of the last start tag with the entities replaced, NULL if the tag has none*/
+	const char* attribute(const char* name) const;
+
+	/* The float value of an attribute, 0 if it is missing*/
+	float		floatAttribute(const char* name) const;
+
+	/* Set value and return true if the attribute is there and holds a number, leave value unchanged otherwise*/
+	bool		queryFloatAttribute(const char* name, float* value) const;
+
+	/* What went wrong after a TOKEN_ERROR, and on which line*/
+	const char* error() const { return m_error; }
+	int			errorLine() const;
+
+private:
+	struct Attribute
+	{
+		const char* name;
+		size_t		nameLength;
+		size_t		value; //offset in m_values
+	};
+
+	Token fail(const char* error);
+	Token readStartTag();
+	Token readEndTag();
+	bool  skipPast(const char* terminator);
+	bool  skipDeclaration();
+	bool  readValue(const char* begin, const char* end);
+
+	const char*				m_text;
+	const char*				m_end;
+	const char*				m_pos;
+	const char*				m_error;
+	bool					m_structureOnly;
+
+	//last start tag
+	const char*				m_name;
+	size_t					m_nameLength;
+	bool					m_empty; //<name/>, its TOKEN_END comes next
+	std::vector<Attribute>	m_attributes;
+	std::vector<char>		m_values; //the attribute values, each ending with a 0
+
+	//names of the open elements, pointing in the text
+	std::vector<std::pair<const char*, size_t> > m_open;
+}; // class XMLTokenizer
+
+}
+
+#endif